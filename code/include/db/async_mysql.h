@@ -0,0 +1,106 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef ASYNC_MYSQL_H
+#define ASYNC_MYSQL_H
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mysqlpool.h"
+#include "epoller/poller.h"
+#include "utils/metrics.h"
+
+namespace msv {
+
+// A login or register request waiting for tb_auth.
+struct VerifyJob {
+    uint64_t handle{};
+    bool isLogin{};
+    std::string username{};
+    std::string password{};
+    // a job whose link was lost is run once more on a fresh one
+    bool retried{};
+    // credential cache epoch taken before the select
+    uint64_t epoch{};
+};
+
+// Non-blocking tb_auth client driven by a reactor's epoll (MariaDB Connector/C non-blocking API).
+// Jobs may be submitted from any thread; queries, completions and the callback run on the reactor thread.
+// A lost link reconnects without blocking; one that cannot is retried when the next job comes in.
+class AsyncMysql {
+public:
+    using CallbackType = void (*)(void* owner, uint64_t handle, bool success);
+
+    static constexpr uint16_t MAX_NUM_CONNECT = 8U;
+    static constexpr std::size_t MAX_FIELD_LENGTH = 64U;
+
+public:
+    AsyncMysql() = default;
+    ~AsyncMysql();
+
+    AsyncMysql(const AsyncMysql& rhs) = delete;
+    AsyncMysql& operator=(const AsyncMysql& rhs) = delete;
+
+    bool Initialize(const MysqlConfig& config, uint16_t numConnect, Poller* poller, CallbackType callback, void* owner);
+
+    void Submit(VerifyJob&& job);
+
+    // false when fd belongs to somebody else
+    bool HandleEvent(int fd, uint32_t events);
+
+private:
+    enum class Stage : uint8_t {
+        IDLE = 0U,
+        CONNECT,
+        BROKEN,
+        SELECT,
+        STORE,
+        INSERT,
+    };
+
+    struct Link {
+        MYSQL* mysql{};
+        MYSQL* connected{};
+        int fd{-1};
+        Stage stage{Stage::IDLE};
+        int error{};
+        MYSQL_RES* result{};
+        std::string query{};
+        Metrics::Clock::time_point start{};
+        VerifyJob job{};
+    };
+
+    void Dispatch();
+
+    void Connect(Link& link);
+    void Drop(Link& link);
+    void Lost(Link& link);
+    // fails queued jobs once no link is left that could take them
+    void FailStranded();
+
+    void Start(Link& link);
+    int Continue(Link& link, int status);
+    void Progress(Link& link, int status);
+    void Finish(Link& link, bool success);
+
+    bool BuildQuery(Link& link, const char* format);
+
+private:
+    MysqlConfig config_{};
+    Poller* poller_{};
+    CallbackType callback_{};
+    void* owner_{};
+
+    int notifyFd_{-1};
+    std::vector<Link> links_{};
+    std::deque<VerifyJob> pending_{};
+
+    std::mutex mutex_{};
+    std::vector<VerifyJob> incoming_{};
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef CREDENTIAL_CACHE_H
+#define CREDENTIAL_CACHE_H
+
+#include <openssl/sha.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "threadpool/threadpool.h"
+
+namespace msv {
+
+// Read-through cache of tb_auth rows. Passwords are kept only as salted SHA-256 digests,
+// users known to be missing are cached too so probing unknown names does not reach the database.
+// Every shard counts invalidations, a row read before one is not cached after it.
+class CredentialCache {
+public:
+    static constexpr std::size_t SHARD_COUNT = 16U;
+    static constexpr std::size_t SALT_SIZE = 16U;
+    static constexpr std::size_t DEFAULT_CAPACITY = 65536U;
+    static constexpr uint32_t DEFAULT_TTL = 300000U;
+    static constexpr uint32_t DEFAULT_NEGATIVE_TTL = 30000U;
+
+    enum class Result : uint8_t {
+        MISS = 0U,
+        MATCH,
+        MISMATCH,
+        ABSENT,
+    };
+
+public:
+    static CredentialCache* Instance()
+    {
+        static CredentialCache cache;
+        return &cache;
+    }
+
+    // ttl values are milliseconds, a zero capacity disables the cache
+    void Initialize(std::size_t capacity, uint32_t ttl, uint32_t negativeTtl);
+
+    Result Check(std::string_view username, std::string_view password);
+
+    // taken before tb_auth is read, what the read found is stored only while it is unchanged
+    uint64_t Epoch(std::string_view username);
+
+    void Store(std::string_view username, std::string_view password, uint64_t epoch);
+    void StoreAbsent(std::string_view username, uint64_t epoch);
+
+    void Invalidate(std::string_view username);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Digest = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+    struct Entry {
+        std::string username{};
+        bool exists{};
+        std::array<unsigned char, SALT_SIZE> salt{};
+        Digest digest{};
+        Clock::time_point expire{};
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::mutex mutex{};
+        std::list<Entry> entries{};
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index{};
+        std::atomic<uint64_t> epoch{};
+    };
+
+    CredentialCache() = default;
+
+    CredentialCache(const CredentialCache& rhs) = delete;
+    CredentialCache& operator=(const CredentialCache& rhs) = delete;
+
+    Shard& ShardOf(std::string_view username);
+
+    void Insert(Entry&& entry, uint64_t epoch);
+
+    static Digest Hash(const std::array<unsigned char, SALT_SIZE>& salt, std::string_view password);
+
+private:
+    std::size_t shardCapacity_{};
+    Clock::duration ttl_{};
+    Clock::duration negativeTtl_{};
+    std::array<Shard, SHARD_COUNT> shards_{};
+};
+
+}
+
+#endif
@@ -4,13 +4,18 @@
 #define MYSQLPOOL_H
 
 #include <string>
-#include <queue>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <memory>
+#include <functional>
 #include <condition_variable>
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 
 #include "utils/mlog.h"
+#include "threadpool/threadpool.h"
+#include "credential_cache.h"
 
 namespace msv {
 
@@ -21,6 +26,57 @@ struct MysqlConfig {
     std::string user{};
     std::string passwd{};
     std::string dbname{};
+    // milliseconds a lease waits for a free connection
+    uint32_t leaseTimeout{1000U};
+    // milliseconds a connection may sit idle before it is pinged on lease
+    uint32_t pingInterval{30000U};
+    // read-through credential cache, see CredentialCache
+    std::size_t credentialCacheSize{CredentialCache::DEFAULT_CAPACITY};
+    uint32_t credentialTtl{CredentialCache::DEFAULT_TTL};
+    uint32_t negativeTtl{CredentialCache::DEFAULT_NEGATIVE_TTL};
+};
+
+// the link itself is gone, as opposed to an error in the statement
+inline bool IsConnectionLost(unsigned int error)
+{
+    return error == CR_SERVER_GONE_ERROR || error == CR_SERVER_LOST;
+}
+
+inline bool IsConnectionLost(MYSQL* mysql)
+{
+    return IsConnectionLost(mysql_errno(mysql));
+}
+
+inline bool IsConnectionLost(MYSQL_STMT* stmt)
+{
+    return IsConnectionLost(mysql_stmt_errno(stmt));
+}
+
+enum class MysqlStatement : uint8_t {
+    SELECT_AUTH = 0U,
+    INSERT_AUTH,
+    COUNT,
+};
+
+// A pooled connection. Statements are prepared on first use and kept until the connection is reset.
+struct MysqlConnection {
+    MYSQL* mysql{};
+    MYSQL_STMT* statements[static_cast<std::size_t>(MysqlStatement::COUNT)]{};
+    std::chrono::steady_clock::time_point lastUsed{};
+
+    MYSQL_STMT* GetStatement(MysqlStatement id);
+
+    // after a use that worked, a connection is pinged only once it has been idle that long
+    void Touch()
+    {
+        lastUsed = std::chrono::steady_clock::now();
+    }
+
+    // after a failed use of stmt, or of the connection when stmt is nullptr. A lost link is reset,
+    // statements included, for the next lease to reconnect; true when that happened.
+    bool Fail(MYSQL_STMT* stmt);
+
+    void Reset();
 };
 
 class MysqlPool {
@@ -43,8 +99,9 @@ public:
         Shutdown();
     }
 
-    MYSQL* GetConnection();
-    void RetConnection(MYSQL* ptr);
+    // nullptr when no connection frees up within the lease timeout
+    MysqlConnection* GetConnection();
+    void RetConnection(MysqlConnection* conn);
 
     void Shutdown();
 
@@ -56,17 +113,29 @@ private:
 
     [[nodiscard]] bool Initialize(const MysqlConfig& config);
 
+    MysqlConnection* TryAcquire();
+    bool Connect(MysqlConnection& conn);
+    bool CheckHealth(MysqlConnection& conn);
+
 private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<bool> busy{};
+        MysqlConnection conn{};
+    };
+
     MysqlConfig config_{};
+    std::size_t numSlots_{};
+    std::unique_ptr<Slot[]> slots_{};
+
+    std::atomic<uint32_t> numWaiting_{};
     std::mutex mutex_{};
-    std::queue<MYSQL*> queue_{};
     std::condition_variable cond_{};
 };
 
 inline auto GetMysqlConnection()
 {
-    using DelFuncType = std::function<void(MYSQL*)>;
-    return std::unique_ptr<MYSQL, DelFuncType>(MysqlPool::Instance()->GetConnection(), [](MYSQL* ptr) { MysqlPool::Instance()->RetConnection(ptr); });
+    using DelFuncType = std::function<void(MysqlConnection*)>;
+    return std::unique_ptr<MysqlConnection, DelFuncType>(MysqlPool::Instance()->GetConnection(), [](MysqlConnection* ptr) { MysqlPool::Instance()->RetConnection(ptr); });
 }
 
 }
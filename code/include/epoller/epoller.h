@@ -7,9 +7,11 @@
 #include <unistd.h>
 #include <vector>
 
+#include "poller.h"
+
 namespace msv {
 
-class Epoller {
+class Epoller : public Poller {
 public:
     static constexpr uint32_t MAX_EVENT_BUFFER_SIZE = 4096U;
 
@@ -27,34 +29,37 @@ public:
         [[maybe_unused]] auto ret = close(efd_);
     }
 
-    bool AddFd(int fd, uint32_t events)
+    using Poller::AddFd;
+    using Poller::ModFd;
+
+    bool AddFd(int fd, uint32_t events, uint64_t data) override
     {
         union epoll_data ed{0};
-        ed.fd = fd;
+        ed.u64 = data;
         struct epoll_event ee{events, ed};
         return 0 == epoll_ctl(efd_, EPOLL_CTL_ADD, fd, &ee);
     }
 
-    bool ModFd(int fd, uint32_t events)
+    bool ModFd(int fd, uint32_t events, uint64_t data) override
     {
         union epoll_data ed{0};
-        ed.fd = fd;
+        ed.u64 = data;
         struct epoll_event ee{events, ed};
         return 0 == epoll_ctl(efd_, EPOLL_CTL_MOD, fd, &ee);
     }
 
-    bool DelFd(int fd)
+    bool DelFd(int fd) override
     {
         struct epoll_event ee{0};
         return 0 == epoll_ctl(efd_, EPOLL_CTL_DEL, fd, &ee);
     }
 
-    int Wait(int timeout)
+    int Wait(int timeout) override
     {
         return epoll_wait(efd_, buffer_.data(), buffer_.size(), timeout);
     }
 
-    const struct epoll_event& operator[](std::size_t index) const
+    const struct epoll_event& operator[](std::size_t index) const override
     {
         return buffer_[index];
     }
@@ -0,0 +1,77 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <sys/epoll.h>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+namespace msv {
+
+enum class PollerType : uint8_t {
+    EPOLL = 0U,
+    IO_URING,
+};
+
+// Completions of the operations a backend runs on the caller's behalf, reported next to the epoll bits.
+// Result() holds what the kernel returned: the accepted descriptor, or the received byte count, 0 at end of stream.
+constexpr uint32_t EVENT_ACCEPTED = 1U << 24;
+constexpr uint32_t EVENT_RECEIVED = 1U << 25;
+
+// Readiness notification backend, events and flags use the epoll constants whatever the engine.
+// data comes back in the event, its low 32 bits must be the fd so data.fd keeps working.
+class Poller {
+public:
+    virtual ~Poller() = default;
+
+    virtual bool AddFd(int fd, uint32_t events, uint64_t data) = 0;
+    virtual bool ModFd(int fd, uint32_t events, uint64_t data) = 0;
+    virtual bool DelFd(int fd) = 0;
+
+    virtual int Wait(int timeout) = 0;
+
+    virtual const struct epoll_event& operator[](std::size_t index) const = 0;
+
+    // Accepts on a listening fd until it is deleted, false when the backend can only report readiness.
+    virtual bool AcceptMulti(int fd, uint64_t data)
+    {
+        return false;
+    }
+
+    // Receives on a connection until it is deleted, stopped, or the peer is gone.
+    // false when the backend can only report readiness, the caller then reads by itself.
+    virtual bool RecvMulti(int fd, uint64_t data)
+    {
+        return false;
+    }
+
+    // receives already under way are still reported
+    virtual void StopRecv(int fd) {}
+
+    virtual int Result(std::size_t index) const
+    {
+        return 0;
+    }
+
+    // the bytes of a received event, valid until the next Wait
+    virtual std::string_view Received(std::size_t index) const
+    {
+        return {};
+    }
+
+    bool AddFd(int fd, uint32_t events)
+    {
+        return AddFd(fd, events, static_cast<uint32_t>(fd));
+    }
+
+    bool ModFd(int fd, uint32_t events)
+    {
+        return ModFd(fd, events, static_cast<uint32_t>(fd));
+    }
+};
+
+}
+
+#endif
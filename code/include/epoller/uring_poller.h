@@ -0,0 +1,154 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <linux/io_uring.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "poller.h"
+
+namespace msv {
+
+// Poller on io_uring. Interest changes become submission entries, the ones made on the waiting thread go to
+// the kernel together with the next Wait instead of one epoll_ctl each. EPOLLET registrations are multishot
+// polls, level triggered ones are re-armed after every completion.
+// Accepts and receives run in the ring as multishot requests, received bytes land in a ring of provided buffers
+// and come back with the completion, so a request costs no readiness event and no read call.
+class UringPoller : public Poller {
+public:
+    static constexpr uint32_t QUEUE_DEPTH = 4096U;
+    static constexpr uint32_t MAX_EVENT_BUFFER_SIZE = 4096U;
+    // provided receive buffers, the count must be a power of two
+    static constexpr uint32_t BUFFER_COUNT = 1024U;
+    static constexpr uint32_t BUFFER_SIZE = 4096U;
+
+public:
+    UringPoller() = default;
+    ~UringPoller() override;
+
+    UringPoller(const UringPoller& rhs) = delete;
+    UringPoller& operator=(const UringPoller& rhs) = delete;
+
+    // false when the kernel has no io_uring or lacks multishot receive (6.0)
+    bool Initialize();
+
+    using Poller::AddFd;
+    using Poller::ModFd;
+
+    bool AddFd(int fd, uint32_t events, uint64_t data) override;
+    bool ModFd(int fd, uint32_t events, uint64_t data) override;
+    bool DelFd(int fd) override;
+
+    int Wait(int timeout) override;
+
+    const struct epoll_event& operator[](std::size_t index) const override
+    {
+        return buffer_[index];
+    }
+
+    bool AcceptMulti(int fd, uint64_t data) override;
+    bool RecvMulti(int fd, uint64_t data) override;
+    void StopRecv(int fd) override;
+
+    int Result(std::size_t index) const override
+    {
+        return completions_[index].result;
+    }
+
+    std::string_view Received(std::size_t index) const override
+    {
+        const auto& completion = completions_[index];
+        return completion.data != nullptr ? std::string_view(completion.data, completion.result) : std::string_view();
+    }
+
+private:
+    enum class Operation : uint8_t {
+        NONE = 0U,
+        ACCEPT,
+        RECV,
+    };
+
+    // a poll and a multishot operation per fd, each with its own generation
+    struct Registration {
+        uint32_t events{};
+        uint64_t data{};
+        uint32_t generation{};
+        bool registered{};
+        bool armed{};
+
+        Operation operation{Operation::NONE};
+        uint64_t operationData{};
+        uint32_t operationGeneration{};
+        // wanted by the caller, and still running in the kernel, a stopped one may still be running
+        bool wanted{};
+        bool running{};
+    };
+
+    struct Completion {
+        int result{};
+        const char* data{};
+    };
+
+    Registration* Find(int fd);
+
+    void Arm(int fd, Registration& registration);
+    void Disarm(int fd, Registration& registration);
+
+    void Start(int fd, Registration& registration);
+    void Cancel(int fd, Registration& registration);
+    // false when the completion is not reported
+    bool Complete(const struct io_uring_cqe& cqe, int fd, Registration& registration, Completion& completion, uint32_t& events);
+
+    bool InitializeBuffers();
+    // hands a receive buffer back to the kernel, visible to it once PublishBuffers runs
+    void ProvideBuffer(uint16_t id);
+    void PublishBuffers();
+
+    struct io_uring_sqe* NextSqe();
+    void Submit();
+    // off the waiting thread nothing would pick the entries up, so they go out right away
+    void SubmitIfForeign();
+
+private:
+    int ringFd_{-1};
+
+    void* sqRing_{};
+    std::size_t sqRingSize_{};
+    void* cqRing_{};
+    std::size_t cqRingSize_{};
+    struct io_uring_sqe* sqes_{};
+    std::size_t sqesSize_{};
+
+    unsigned* sqHead_{};
+    unsigned* sqTail_{};
+    unsigned sqMask_{};
+    unsigned sqEntries_{};
+    unsigned* sqArray_{};
+    unsigned* cqHead_{};
+    unsigned* cqTail_{};
+    unsigned cqMask_{};
+    struct io_uring_cqe* cqes_{};
+
+    unsigned sqLocalTail_{};
+    unsigned numPending_{};
+
+    struct io_uring_buf_ring* bufRing_{};
+    std::size_t bufRingSize_{};
+    char* bufBase_{};
+    uint16_t bufTail_{};
+    // buffers reported by the last Wait, given back at the start of the next one
+    std::vector<uint16_t> lentBuffers_{};
+
+    std::mutex mutex_{};
+    std::thread::id owner_{};
+    std::vector<Registration> registrations_{};
+    std::vector<struct epoll_event> buffer_{};
+    std::vector<Completion> completions_{};
+};
+
+}
+
+#endif
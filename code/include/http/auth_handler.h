@@ -0,0 +1,54 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef AUTH_HANDLER_H
+#define AUTH_HANDLER_H
+
+#include "router.h"
+#include "db/mysqlpool.h"
+#include "utils/metrics.h"
+
+namespace msv {
+
+namespace http {
+
+// Login and register forms against tb_auth. The credential cache answers first; what it cannot decide goes to
+// the blocking pool, or with AsyncVerify is deferred to the reactor's AsyncMysql and finished by Resume.
+class AuthHandler {
+public:
+    static constexpr std::string_view SUCCESS_PAGE = "/home.html";
+    static constexpr std::string_view FAILURE_PAGE = "/error.html";
+
+    static void Login(Exchange& exchange)
+    {
+        Handle(exchange, true);
+    }
+
+    static void Register(Exchange& exchange)
+    {
+        Handle(exchange, false);
+    }
+
+    static void Resume(Exchange& exchange)
+    {
+        Finish(exchange, exchange.GetResult());
+    }
+
+    // credentials are checked by the reactor's AsyncMysql instead of a blocking pooled connection
+    static bool AsyncVerify;
+
+private:
+    static void Handle(Exchange& exchange, bool isLogin);
+    static void Finish(Exchange& exchange, bool success);
+
+    // true when the credential cache alone decides the request, success then holds the outcome
+    static bool VerifyCached(const Credentials& credentials, bool& success);
+    // one DB latency sample per verification, whatever way it ends
+    static bool Verify(const Credentials& credentials);
+    static bool Query(const Credentials& credentials);
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <filesystem>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "http_header.h"
+
+namespace msv {
+
+namespace http {
+
+using Path = std::filesystem::path;
+
+// A resource plus its prebuilt 200 response headers.
+// Small files are mapped (data), large ones keep an open descriptor for sendfile (fd).
+// A compressed variant holds its body in memory (encoded) and data points into it.
+struct CachedFile {
+    ~CachedFile();
+
+    const char* data{};
+    int fd{-1};
+    std::size_t size{};
+    time_t mtime{};
+    std::string lastModified{};
+    // strong validator from inode, mtime and size, a coding suffix tells variants apart
+    std::string etag{};
+    std::string cacheControl{};
+    std::string contentType{};
+    // text types, worth a compressed variant
+    bool compressible{};
+    ContentEncoding encoding{ContentEncoding::IDENTITY};
+    std::string encoded{};
+    // indexed by keep-alive
+    std::string header[2]{};
+    std::string notModified[2]{};
+};
+
+using CachedFilePtr = std::shared_ptr<const CachedFile>;
+
+// Shared, size-bounded cache of the files under the resource directory.
+// Lookups take a shared lock only; eviction is CLOCK-style so hits never write the table.
+// Changes on disk are picked up through inotify, driven by whoever polls GetNotifyFd().
+class FileCache {
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 64U << 20;
+    static constexpr std::size_t DEFAULT_SENDFILE_THRESHOLD = 256U << 10;
+
+    static FileCache* Instance()
+    {
+        static FileCache cache;
+        return &cache;
+    }
+
+    ~FileCache();
+
+    bool Initialize(const Path& root, std::size_t capacity = DEFAULT_CAPACITY, std::size_t sendfileThreshold = DEFAULT_SENDFILE_THRESHOLD);
+
+    // nullptr when the file does not exist or cannot be mapped
+    CachedFilePtr Get(const Path& path);
+
+    // The variant of a compressible file in the given coding: a fresh ".gz" sibling for gzip, otherwise
+    // the file compressed once with zlib. Falls back to the file itself when compressing does not pay off.
+    CachedFilePtr GetEncoded(const Path& path, const CachedFilePtr& file, ContentEncoding encoding);
+
+    int GetNotifyFd() const
+    {
+        return notifyFd_;
+    }
+
+    void HandleNotify();
+
+private:
+    struct Entry {
+        CachedFilePtr file{};
+        std::size_t cost{};
+        mutable std::atomic<bool> referenced{};
+    };
+
+    static constexpr int COMPRESS_LEVEL = 6;
+    // below this the headers dominate, compressing saves nothing
+    static constexpr std::size_t MIN_COMPRESS_SIZE = 256U;
+
+    FileCache() = default;
+
+    FileCache(const FileCache& rhs) = delete;
+    FileCache& operator=(const FileCache& rhs) = delete;
+
+    std::shared_ptr<CachedFile> Load(const Path& path) const;
+    std::shared_ptr<CachedFile> LoadContent(const Path& path) const;
+    CachedFilePtr LoadSibling(const Path& path, const CachedFile& file) const;
+    CachedFilePtr Compress(const CachedFile& file, ContentEncoding encoding) const;
+
+    static constexpr const char* CODINGS[] = {"identity", "gzip", "deflate"};
+
+    static std::string Tagged(const std::string& etag, ContentEncoding encoding);
+    static void MakeHeaders(CachedFile& file);
+
+    // variants live next to their file in the table, a NUL cannot appear in a path
+    static std::string VariantKey(const std::string& key, ContentEncoding encoding)
+    {
+        return key + '\0' + static_cast<char>('0' + static_cast<int>(encoding));
+    }
+
+    // descriptor-backed entries cost no memory, only mapped ones count against the capacity
+    static std::size_t Cost(const CachedFile& file)
+    {
+        return file.data != nullptr ? file.size : 0U;
+    }
+
+    CachedFilePtr Find(const std::string& key);
+    void Insert(const std::string& key, const CachedFilePtr& file, std::size_t cost, uint64_t generation);
+    void InsertVariant(const std::string& key, const CachedFilePtr& variant, std::size_t cost, uint64_t generation, const std::string& originKey, const CachedFilePtr& origin);
+    void Publish(const std::string& key, const CachedFilePtr& file, std::size_t cost);
+    void Evict();
+    void Erase(const std::string& key);
+    void Invalidate(const std::string& key, bool isDirectory);
+
+    void AddWatch(const Path& dir);
+
+private:
+    std::size_t capacity_{DEFAULT_CAPACITY};
+    std::size_t maxFileSize_{DEFAULT_CAPACITY / 8};
+    std::size_t sendfileThreshold_{DEFAULT_SENDFILE_THRESHOLD};
+
+    std::shared_mutex mutex_{};
+    // bumped on every invalidation, a load that raced with one is not published
+    std::atomic<uint64_t> generation_{};
+    std::size_t size_{};
+    std::unordered_map<std::string, Entry> entries_{};
+    // key of the entry the clock hand points at, a sweep resumes there
+    std::string hand_{};
+
+    int notifyFd_{-1};
+    std::unordered_map<int, Path> watches_{};
+};
+
+}
+
+}
+
+#endif
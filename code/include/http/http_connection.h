@@ -4,10 +4,18 @@
 #define CONNECTION_H
 
 #include <arpa/inet.h>
+#include <strings.h>
+#include <atomic>
+#include <climits>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "read_buffer.h"
 #include "request_parser.h"
 #include "response_maker.h"
+#include "router.h"
+#include "utils/metrics.h"
 
 namespace msv {
 
@@ -22,42 +30,103 @@ class HttpConnection {
 public:
     HttpConnection() = default;
 
+    HttpConnection(const HttpConnection& rhs) = delete;
+    HttpConnection& operator=(const HttpConnection& rhs) = delete;
+
     ~HttpConnection()
     {
+        Claim();
         Close();
     }
 
     void Initialize(TriggerMode triggerMode, int cfd, struct sockaddr_in caddr);
 
+    // only the caller that gets true deregisters and closes, the socket stays open until Close
+    bool Claim()
+    {
+        return !closed_.exchange(true);
+    }
+
     void Close()
     {
-        [[maybe_unused]] auto ret = close(cfd_);
-        Initialize(TriggerMode::TM_LT, -1, {});
-        closed_ = true;
+        if (cfd_ < 0) {
+            return;
+        }
+        // the reactor may hand the slot to a new connection on this fd as soon as it is closed, so close last
+        auto cfd = cfd_;
+        cfd_ = -1;
+        ResetResponses();
 
         NumOnline -= 1;
+        [[maybe_unused]] auto ret = close(cfd);
     }
 
     bool IsClosed() const
     {
-        return closed_ == true;
+        return closed_.load();
     }
 
     bool Read()
     {
-        if (triggerMode_ == TriggerMode::TM_LT) {
-            return readBuffer_.ReadLT(cfd_);
+        auto size = readBuffer_.Size();
+        auto ret = triggerMode_ == TriggerMode::TM_LT ? readBuffer_.ReadLT(cfd_) : readBuffer_.ReadET(cfd_, requestParser_.ReadLimit());
+        readLimited_ = triggerMode_ == TriggerMode::TM_ET && readBuffer_.Size() >= requestParser_.ReadLimit();
+        Metrics::Add(Counter::BYTES_IN, readBuffer_.Size() - size);
+        return ret;
+    }
+
+    // an edge triggered read stopped at the limit and the parser has made room since,
+    // the input left behind is not reported by a new edge
+    bool HasUnreadInput() const
+    {
+        return readLimited_ && readBuffer_.Size() < requestParser_.ReadLimit();
+    }
+
+    // bytes the poller received on the connection's behalf, false once the parser takes no more for now
+    bool Receive(std::string_view data)
+    {
+        readBuffer_.Append(data);
+        readLimited_ = readBuffer_.Size() >= requestParser_.ReadLimit();
+        Metrics::Add(Counter::BYTES_IN, data.size());
+        return !readLimited_;
+    }
+
+    // receiving stopped at the limit and the parser has made room since, it counts as resumed from here
+    bool ResumeReceive()
+    {
+        if (!HasUnreadInput()) {
+            return false;
         }
-        return readBuffer_.ReadET(cfd_);
+        readLimited_ = false;
+        return true;
     }
 
+    // answers every complete request in the read buffer, up to MAX_PIPELINE_DEPTH, as one ordered batch
     bool Process();
 
     bool Write();
 
+private:
+    bool ProcessOne();
+    void Enqueue(ResponseData&& response);
+    void ResetResponses();
+
+    bool WriteMemory(std::size_t boundary);
+    bool WriteFile();
+    // next piece of a streamed body, called only after the batch before it is written out
+    bool Produce();
+
+    bool BatchWritten() const
+    {
+        return iovPos_ == iovecs_.size() && filePos_ == files_.size();
+    }
+
+    void ClearBatch();
+
+public:
     bool WriteComplete() const
     {
-        return (writeBuffer_[0].iov_len + writeBuffer_[1].iov_len) == 0;
+        return BatchWritten() && producer_ == nullptr;
     }
 
     int GetFd() const
@@ -70,6 +139,37 @@ public:
         return keepAlive_;
     }
 
+    // EPOLLOUT registered for a write that hit EAGAIN, ownership mode only
+    bool HasWriteInterest() const
+    {
+        return writeInterest_;
+    }
+
+    void SetWriteInterest(bool enable)
+    {
+        writeInterest_ = enable;
+    }
+
+    // a request deferred by its handler until its credentials are checked, Process resumes it after FinishVerify
+    bool IsVerifyPending() const
+    {
+        return exchange_.IsWaiting();
+    }
+
+    const Credentials& GetCredentials() const
+    {
+        return exchange_.GetCredentials();
+    }
+
+    void FinishVerify(bool success)
+    {
+        exchange_.Complete(success);
+    }
+
+    static constexpr std::size_t MAX_PIPELINE_DEPTH = 16U;
+    // the most a streamed body is produced ahead of the socket
+    static constexpr std::size_t STREAM_CHUNK_SIZE = 16U << 10;
+
     static std::filesystem::path ResDir;
     static std::atomic<uint32_t> NumOnline;
 
@@ -78,14 +178,36 @@ private:
     int cfd_ = -1;
     struct sockaddr_in caddr_ = {0, {0}, {0}};
 
-    bool closed_{};
+    std::atomic<bool> closed_{true};
     bool keepAlive_{};
-    ResponseData responseData_{};
-    struct iovec writeBuffer_[2]{};
+    bool writeInterest_{};
+    bool readLimited_{};
+    Metrics::Clock::time_point writeStart_{};
+
+    // A body sent by sendfile goes out after the iovecs queued before it.
+    struct FilePart {
+        std::size_t iovIndex{};
+        int fd{-1};
+        off_t offset{};
+        std::size_t remain{};
+    };
+
+    // the batch being written, responses own the memory the iovecs point to
+    std::vector<ResponseData> responses_{};
+    std::vector<struct iovec> iovecs_{};
+    std::vector<FilePart> files_{};
+    std::size_t iovPos_{};
+    std::size_t filePos_{};
+
+    // a streamed body ends its batch, pipelined requests behind it wait until it is done
+    std::shared_ptr<BodyProducer> producer_{};
+    bool chunked_{};
+    std::string produced_{};
+    char chunkSize_[24]{};
 
     ReadBuffer readBuffer_{};
     RequestParser requestParser_{};
-    ResponseMaker responseMaker_{};
+    Exchange exchange_{requestParser_};
 };
 
 }
@@ -0,0 +1,147 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <array>
+#include <ctime>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace msv {
+
+namespace http {
+
+enum class HeaderField : uint8_t {
+    CONNECTION = 0U,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    HOST,
+    USER_AGENT,
+    ACCEPT,
+    ACCEPT_ENCODING,
+    TRANSFER_ENCODING,
+    RANGE,
+    IF_RANGE,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    COUNT,
+    UNKNOWN = COUNT,
+};
+
+enum class Method : uint8_t {
+    GET = 0U,
+    POST,
+    COUNT,
+    UNKNOWN = COUNT,
+};
+
+Method ParseMethod(std::string_view method);
+
+// the request line token, empty for UNKNOWN
+std::string_view MethodName(Method method);
+
+bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs);
+
+std::string_view TrimWhitespace(std::string_view str);
+
+// One byte-range-spec of a Range header, not yet resolved against a length.
+// first < 0 is a suffix range of the last `last` bytes, last < 0 is an open-ended range.
+struct ByteRange {
+    int64_t first{};
+    int64_t last{};
+};
+
+// Decimal Content-Length, fails on anything but digits or on overflow.
+bool ParseContentLength(std::string_view value, std::size_t& length);
+
+// Hex size of a chunk-size line, chunk extensions are ignored.
+bool ParseChunkSize(std::string_view line, std::size_t& size);
+
+// Decodes one application/x-www-form-urlencoded component in place: '+' becomes a space, %XX a byte.
+// The result never grows, length is updated. Fails on a malformed escape.
+bool DecodeFormComponent(char* data, std::size_t& length);
+
+// Parses "bytes=a-b, c-, -d" into ranges, fails on any syntax error.
+bool ParseByteRanges(std::string_view value, std::vector<ByteRange>& ranges);
+
+// Validators of a conditional GET. If-Modified-Since is dropped when If-None-Match is present.
+struct Preconditions {
+    std::string_view ifNoneMatch{};
+    time_t ifModifiedSince{-1};
+};
+
+// IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+bool ParseHttpDate(std::string_view value, time_t& time);
+
+// If-None-Match uses the weak comparison, "*" matches any current representation
+bool MatchEntityTag(std::string_view list, std::string_view etag);
+
+enum class ContentEncoding : uint8_t {
+    IDENTITY = 0U,
+    GZIP,
+    DEFLATE,
+    COUNT,
+};
+
+constexpr uint8_t EncodingBit(ContentEncoding encoding)
+{
+    return 1U << static_cast<uint8_t>(encoding);
+}
+
+// Codings an Accept-Encoding value allows as a mask of EncodingBit, identity is always assumed.
+// Preferences between codings are ignored, only q=0 rules one out.
+uint8_t ParseAcceptEncoding(std::string_view value);
+
+// Flat header table: well-known fields live in a fixed array indexed by HeaderField,
+// everything else goes to a small linear list. Strings keep their capacity across Clear().
+class HeaderTable {
+public:
+    static HeaderField Lookup(std::string_view name);
+
+    void Set(std::string_view name, std::string_view value);
+
+    bool Has(HeaderField field) const
+    {
+        return present_ & Bit(field);
+    }
+
+    std::string_view Get(HeaderField field) const
+    {
+        return Has(field) ? std::string_view(known_[Index(field)]) : std::string_view();
+    }
+
+    std::string_view Get(std::string_view name) const;
+
+    void Clear()
+    {
+        present_ = 0U;
+        numOthers_ = 0U;
+    }
+
+private:
+    static constexpr std::size_t Index(HeaderField field)
+    {
+        return static_cast<std::size_t>(field);
+    }
+
+    static constexpr uint32_t Bit(HeaderField field)
+    {
+        return 1U << Index(field);
+    }
+
+private:
+    uint32_t present_{};
+    std::array<std::string, static_cast<std::size_t>(HeaderField::COUNT)> known_{};
+
+    std::size_t numOthers_{};
+    std::vector<std::pair<std::string, std::string>> others_{};
+};
+
+}
+
+}
+
+#endif
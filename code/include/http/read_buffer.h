@@ -3,58 +3,87 @@
 #ifndef READ_BUFFER_H
 #define READ_BUFFER_H
 
-#include <deque>
+#include <vector>
 #include <errno.h>
 #include <unistd.h>
 #include <string>
+#include <string_view>
 #include <optional>
 
 namespace msv {
 
 namespace http {
 
+// Contiguous read buffer: [readPos_, writePos_) holds unconsumed bytes.
+// Views returned by GetLine/GetBytes stay valid until the next read into the buffer.
+// GetLine remembers how far it already scanned, so a line split across reads is scanned once.
 class ReadBuffer {
 public:
     static constexpr std::size_t MAX_ONCE_READ_SIZE = 4096U;
+    static constexpr std::size_t EXTRA_READ_SIZE = 65536U;
 
     bool ReadLT(int fd);
-    bool ReadET(int fd);
+    // reads until EAGAIN, or until at least limit bytes are buffered
+    bool ReadET(int fd, std::size_t limit);
+    // bytes read by someone else, e.g. received through io_uring
+    void Append(std::string_view data);
 
-    std::optional<std::string> GetLine();
-    std::optional<std::string> GetBytes(std::size_t n);
+    std::optional<std::string_view> GetLine();
+    std::optional<std::string_view> GetBytes(std::size_t n);
 
     bool Empty() const
     {
-        return data_.empty();
+        return readPos_ == writePos_;
     }
 
     std::size_t Size() const
     {
-        return data_.size();
+        return writePos_ - readPos_;
     }
 
     void RemoveFront(std::size_t n)
     {
-        n = std::min(n, Size());
-        data_.erase(data_.begin(), data_.begin() + n);
+        readPos_ += std::min(n, Size());
+        scanPos_ = 0;
+        if (Empty()) {
+            readPos_ = writePos_ = 0;
+        }
     }
 
     void Clear()
     {
-        data_.clear();
+        readPos_ = writePos_ = scanPos_ = 0;
+    }
+
+    std::string_view View() const
+    {
+        return {data_.data() + readPos_, Size()};
     }
 
     std::string String() const
     {
-        return std::string(data_.begin(), data_.end());
+        return std::string(View());
+    }
+
+private:
+    ssize_t ReadOnce(int fd);
+
+    void MakeSpace(std::size_t n);
+
+    std::size_t Writable() const
+    {
+        return data_.size() - writePos_;
     }
 
 private:
-    std::deque<char> data_;
+    std::vector<char> data_;
+    std::size_t readPos_{};
+    std::size_t writePos_{};
+    std::size_t scanPos_{};
 };
 
 }
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -3,12 +3,12 @@
 #ifndef REQUEST_PARSER_H
 #define REQUEST_PARSER_H
 
-#include <map>
-#include <set>
-#include <regex>
+#include <optional>
+#include <strings.h>
 
 #include "read_buffer.h"
-#include "db/mysqlpool.h"
+#include "http_header.h"
+#include "utils/mlog.h"
 
 namespace msv {
 
@@ -16,10 +16,22 @@ namespace http {
 
 class RequestParser {
 public:
+    static constexpr std::size_t MAX_RANGE_COUNT = 16U;
+    // a request line or header line longer than this is refused instead of buffered
+    static constexpr std::size_t MAX_LINE_SIZE = 8192U;
+    static constexpr std::size_t DEFAULT_MAX_BODY_SIZE = 64U << 10;
+
+    // bodies beyond this are answered with 413 before they are read
+    static std::size_t MaxBodySize;
+
     enum class ParseStatus: uint8_t {
         REQUESTLINE = 0U,
         HEADER,
         BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_CRLF,
+        CHUNK_TRAILER,
         FINISH,
     };
 
@@ -27,6 +39,7 @@ public:
         NO_REQUEST = 0U,
         GET_REQUEST,
         BAD_REQUEST,
+        TOO_LARGE,
     };
 
 public:
@@ -39,40 +52,80 @@ public:
 
     void Reset();
 
-    bool ParseRequestLine(const std::string& line);
+    bool ParseRequestLine(std::string_view line);
 
-    void FormatPath();
+    bool ParseHeader(std::string_view line);
 
-    bool ParseHeader(const std::string& line);
+    // NO_REQUEST when the body is to be read or is left unread for a request nothing takes,
+    // BAD_REQUEST or TOO_LARGE when it is refused up front
+    RetStatus StartBody();
 
-    bool ParseBody(const std::string& line);
+    RetStatus Parse(ReadBuffer& rdbuf);
 
-    void UserVerify();
+    // the most worth buffering ahead of Parse: a partial line and what the body may still grow by
+    std::size_t ReadLimit() const
+    {
+        return MAX_LINE_SIZE + (MaxBodySize - std::min(body_.size(), MaxBodySize));
+    }
 
-    RetStatus Parse(ReadBuffer& rdbuf);
+    // Decodes an application/x-www-form-urlencoded body in place, the values then point into it.
+    bool DecodeForm();
+
+    // nullopt when the decoded form has no such field
+    std::optional<std::string_view> GetFormValue(std::string_view name) const;
+
+    bool IsHttp11() const
+    {
+        return version_ == "1.1";
+    }
 
+    // a body left unread would be taken for the next request
     bool IsKeepAlive() const
     {
-        if (version_ != "1.1") {
+        if (!IsHttp11() || bodyRefused_) {
             return false;
         }
-        auto iter = header_.find("Connection");
-        return iter != header_.end() && iter->second == "keep-alive";
+        return EqualsIgnoreCase(header_.Get(HeaderField::CONNECTION), "keep-alive");
     }
 
-    std::string GetPath() const
+    Method GetMethod() const
+    {
+        return ParseMethod(method_);
+    }
+
+    // the request target, query included
+    const std::string& GetPath() const
     {
         return path_;
     }
 
+    std::string_view GetHeader(HeaderField field) const
+    {
+        return header_.Get(field);
+    }
+
+    // Ranges of a GET request, nullptr when there is no usable Range header.
+    const std::vector<ByteRange>* ParseRange();
+
+    // Validators of a GET request, an unparsable If-Modified-Since is ignored.
+    Preconditions ParseConditions() const;
+
 private:
     ParseStatus parseStatus_{ParseStatus::REQUESTLINE};
     
     std::string method_;
     std::string path_;
     std::string version_;
-    std::map<std::string, std::string> header_;
-    std::map<std::string, std::string> body_;
+    HeaderTable header_;
+    std::vector<ByteRange> ranges_;
+
+    // raw body as received, chunk framing removed, capacity kept across requests
+    std::string body_;
+    // body bytes still expected, of the whole body or of the current chunk
+    std::size_t remaining_{};
+    bool bodyRefused_{};
+    // decoded fields, capacity kept across requests
+    std::vector<std::pair<std::string_view, std::string_view>> form_;
 };
 
 }
@@ -4,63 +4,164 @@
 #define RESPONSE_MAKER_H
 
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <unistd.h>
 #include <sys/uio.h>
-#include <sys/mman.h>
-#include <fcntl.h>
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <vector>
+#include <ctime>
 
 #include "utils/mlog.h"
+#include "file_cache.h"
+#include "http_header.h"
 
 namespace msv {
 
 namespace http {
 
-using Path = std::filesystem::path;
+// One piece of a body chain: memory (data) or a file range sent by the kernel (fd).
+struct BodySegment {
+    const char* data{};
+    std::size_t length{};
+    int fd{-1};
+    off_t offset{};
+};
+
+// Generates a body piece by piece. It is pulled only once everything produced before has been handed to the socket,
+// so a slow client throttles the producer instead of growing memory. Each call must append something or finish.
+class BodyProducer {
+public:
+    virtual ~BodyProducer() = default;
+
+    // appends at most limit bytes to out and sets done with the last piece, false on failure
+    virtual bool Produce(std::string& out, std::size_t limit, bool& done) = 0;
+};
 
+// Header and body point into storage owned by the response itself (file, storage) or by static tables,
+// so a response stays valid for as long as it is kept around.
+// The body is in memory (body), sent from a descriptor by the kernel (fileFd), followed by any number of
+// chained segments, and finally whatever the producer generates, framed as chunks when chunked is set.
 struct ResponseData {
-    std::string header{};
+    std::string_view header{};
     const char* body{};
     std::size_t bodyLength{};
+    CachedFilePtr file{};
+    int fileFd{-1};
+    off_t fileOffset{};
+    std::size_t fileLength{};
+    std::shared_ptr<const std::string> storage{};
+    std::vector<BodySegment> chain{};
+    std::shared_ptr<BodyProducer> producer{};
+    bool chunked{};
 };
 
-struct MmapInfo {
-    void* ptr{};
-    std::size_t size{};
+// What the request asked for beyond the resource itself.
+struct RequestOptions {
+    const std::vector<ByteRange>* ranges{};
+    std::string_view ifRange{};
+    // mask of EncodingBit from Accept-Encoding
+    uint8_t encodings{EncodingBit(ContentEncoding::IDENTITY)};
+    Preconditions conditions{};
 };
 
 class ResponseMaker {
 public:
     ResponseMaker() = default;
+    ~ResponseMaker() = default;
+
+    ResponseData Make(const Path& resPath, int code, bool isKeepAlive, const RequestOptions& options = {});
+
+    // generated in-memory content, e.g. /metrics
+    static ResponseData MakeText(int code, bool isKeepAlive, const std::string& contentType, const std::string& body);
+
+    // an error page with extra header lines, e.g. the Allow of a 405
+    static ResponseData MakeError(int code, bool isKeepAlive, std::string_view extra);
 
-    ~ResponseMaker()
+    // content of unknown length, sent with chunked transfer-encoding as the producer makes it, HTTP/1.1 clients only
+    static ResponseData MakeStream(int code, bool isKeepAlive, const std::string& contentType, std::shared_ptr<BodyProducer> producer);
+
+    // extra: additional header lines, each terminated by CRLF
+    static std::string MakeHeader(int code, bool isKeepAlive, const std::string& contentType, std::size_t contentLength, std::string_view extra = {});
+
+    static std::string GetContentType(const Path& resPath);
+
+    static std::string GetCacheControl(const Path& resPath);
+
+    static std::string FormatHttpDate(time_t time);
+
+private:
+    // gzip first, it is the one a precompressed sibling can provide
+    static ContentEncoding PickEncoding(uint8_t encodings)
     {
-        Reset();
+        if (encodings & EncodingBit(ContentEncoding::GZIP)) {
+            return ContentEncoding::GZIP;
+        }
+        if (encodings & EncodingBit(ContentEncoding::DEFLATE)) {
+            return ContentEncoding::DEFLATE;
+        }
+        return ContentEncoding::IDENTITY;
     }
 
-    void Reset()
+    static bool IsNotModified(const CachedFile& file, const Preconditions& conditions)
     {
-        if (mmapInfo_.ptr) {
-            munmap(mmapInfo_.ptr, mmapInfo_.size);
+        if (!conditions.ifNoneMatch.empty()) {
+            return MatchEntityTag(conditions.ifNoneMatch, file.etag);
         }
-        mmapInfo_ = {};
+        return conditions.ifModifiedSince >= 0 && file.mtime <= conditions.ifModifiedSince;
     }
 
-    ResponseData Make(const Path& resPath, int code, bool isKeepAlive);
+    static ResponseData MakeFull(const CachedFilePtr& file, bool isKeepAlive);
+    static ResponseData MakeRange(const CachedFilePtr& file, bool isKeepAlive, const RequestOptions& options);
+    static ResponseData MakeMultipart(const CachedFilePtr& file, bool isKeepAlive, const std::vector<ByteRange>& ranges);
+
+    // everything but the framing of the body
+    static std::string MakeHeaderFields(int code, bool isKeepAlive, const std::string& contentType, std::string_view extra);
+
+    static constexpr int ERROR_CODES[] = {400, 404, 405, 413};
+
+    static bool IsErrorCode(int code)
+    {
+        return std::find(std::begin(ERROR_CODES), std::end(ERROR_CODES), code) != std::end(ERROR_CODES);
+    }
+
+    static std::size_t ErrorIndex(int code)
+    {
+        return std::find(std::begin(ERROR_CODES), std::end(ERROR_CODES), code) - std::begin(ERROR_CODES);
+    }
 
-private:
     static const std::string& GetErrorBody(int code)
     {
-        static const std::string html400 = "<html><title>Error</title><body><p>400 Bad Request!</p></body></html>";
-        static const std::string html404 = "<html><title>Error</title><body><p>404 Not found!</p></body></html>";
+        static const std::string bodies[] = {
+            "<html><title>Error</title><body><p>400 Bad Request!</p></body></html>",
+            "<html><title>Error</title><body><p>404 Not found!</p></body></html>",
+            "<html><title>Error</title><body><p>405 Method Not Allowed!</p></body></html>",
+            "<html><title>Error</title><body><p>413 Content Too Large!</p></body></html>",
+        };
+        return bodies[ErrorIndex(code)];
+    }
 
-        return code == 400 ? html400 : html404;
+    static const std::string& GetErrorHeader(int code, bool isKeepAlive)
+    {
+        auto make = [](int code, bool isKeepAlive) {
+            return MakeHeader(code, isKeepAlive, "text/html", GetErrorBody(code).length());
+        };
+        static const std::string headers[][2] = {
+            {make(400, false), make(400, true)},
+            {make(404, false), make(404, true)},
+            {make(405, false), make(405, true)},
+            {make(413, false), make(413, true)},
+        };
+        return headers[ErrorIndex(code)][isKeepAlive];
     }
 
     static std::string GetCodeStatus(int code)
     {
-        static const std::map<int, std::string> mapping = {{200, "OK"}, {400, "Bad Request"}, {404, "Not Found"}};
+        static const std::map<int, std::string> mapping = {
+            {200, "OK"}, {206, "Partial Content"}, {304, "Not Modified"}, {400, "Bad Request"}, {404, "Not Found"}, {405, "Method Not Allowed"}, {413, "Content Too Large"}, {416, "Range Not Satisfiable"},
+        };
         return mapping.find(code)->second;
     }
 
@@ -68,15 +169,10 @@ private:
     {
         return "HTTP/1.1 " + std::to_string(code) + " " + GetCodeStatus(code) + "\r\n";
     }
-
-    static std::string GetContentType(const Path& resPath);
-
-private:
-    MmapInfo mmapInfo_;
 };
 
 }
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,256 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "request_parser.h"
+#include "response_maker.h"
+
+namespace msv {
+
+namespace http {
+
+class Exchange;
+
+using Handler = void (*)(Exchange& exchange);
+
+// One endpoint. Segments of the pattern starting with ':' capture a path segment, e.g. "/user/:name".
+// Pattern and arg are not copied, they are meant to come from a static route table.
+struct Route {
+    Method method{Method::GET};
+    std::string_view pattern{};
+    Handler handler{};
+    // handed to the handler as is, e.g. the page a route serves
+    std::string_view arg{};
+};
+
+// Credentials a deferred request waits on, they point into the request body.
+struct Credentials {
+    bool isLogin{};
+    std::string_view username{};
+    std::string_view password{};
+};
+
+// A request on its way through a handler. The handler either responds or defers,
+// a deferred request is finished by its resume handler once Complete delivers the result.
+class Exchange {
+public:
+    static constexpr std::size_t MAX_PARAMS = 4U;
+
+    explicit Exchange(RequestParser& request) : request_(request) {}
+
+    Exchange(const Exchange& rhs) = delete;
+    Exchange& operator=(const Exchange& rhs) = delete;
+
+    void Begin()
+    {
+        response_ = {};
+        keepAlive_ = request_.IsKeepAlive();
+        route_ = nullptr;
+        numParams_ = 0;
+        tail_ = {};
+    }
+
+    // a connection starting over drops whatever was deferred
+    void Reset()
+    {
+        response_ = {};
+        deferState_ = DeferState::NONE;
+    }
+
+    RequestParser& Request()
+    {
+        return request_;
+    }
+
+    std::string_view Arg() const
+    {
+        return route_ != nullptr ? route_->arg : std::string_view();
+    }
+
+    // empty when the route has no such parameter
+    std::string_view Param(std::string_view name) const
+    {
+        for (std::size_t i = 0; i < numParams_; ++i) {
+            if (params_[i].first == name) {
+                return params_[i].second;
+            }
+        }
+        return {};
+    }
+
+    // the path below a static mount
+    std::string_view Tail() const
+    {
+        return tail_;
+    }
+
+    bool IsKeepAlive() const
+    {
+        return keepAlive_;
+    }
+
+    void Respond(ResponseData&& response)
+    {
+        response_ = std::move(response);
+    }
+
+    // 400 and 413 leave the rest of the request unread, the connection is not reused after them
+    void RespondError(int code);
+
+    // 405 listing the methods the path does take
+    void RespondNotAllowed(std::string_view allow);
+
+    // the file at path, or 404, honouring ranges, preconditions and Accept-Encoding
+    void ServeFile(const std::string& path);
+
+    ResponseData TakeResponse()
+    {
+        return std::move(response_);
+    }
+
+    void Defer(Handler resume, const Credentials& credentials)
+    {
+        resume_ = resume;
+        credentials_ = credentials;
+        deferState_ = DeferState::WAITING;
+    }
+
+    void Complete(bool success)
+    {
+        result_ = success;
+        deferState_ = DeferState::READY;
+    }
+
+    // false while the result is outstanding
+    bool Resume()
+    {
+        if (deferState_ != DeferState::READY) {
+            return false;
+        }
+        deferState_ = DeferState::NONE;
+        resume_(*this);
+        return true;
+    }
+
+    bool IsDeferred() const
+    {
+        return deferState_ != DeferState::NONE;
+    }
+
+    bool IsWaiting() const
+    {
+        return deferState_ == DeferState::WAITING;
+    }
+
+    const Credentials& GetCredentials() const
+    {
+        return credentials_;
+    }
+
+    bool GetResult() const
+    {
+        return result_;
+    }
+
+private:
+    friend class Router;
+
+    enum class DeferState : uint8_t {
+        NONE = 0U,
+        WAITING,
+        READY,
+    };
+
+    RequestParser& request_;
+    ResponseMaker responseMaker_{};
+    ResponseData response_{};
+    bool keepAlive_{};
+
+    const Route* route_{};
+    std::array<std::pair<std::string_view, std::string_view>, MAX_PARAMS> params_{};
+    std::size_t numParams_{};
+    std::string_view tail_{};
+
+    DeferState deferState_{DeferState::NONE};
+    Handler resume_{};
+    Credentials credentials_{};
+    bool result_{};
+};
+
+// Maps method and path to handlers through a segment trie built at startup, lookups do not allocate.
+// A literal segment is preferred over a parameter, there is no backtracking between them.
+// Paths no route takes are served from the deepest static mount above them, GET only.
+class Router {
+public:
+    static Router* Instance()
+    {
+        static Router router;
+        return &router;
+    }
+
+    // fails on a route already taken or too many parameters
+    bool Add(const Route& route);
+
+    template <std::size_t N>
+    bool AddAll(const Route (&routes)[N])
+    {
+        for (const auto& route : routes) {
+            if (!Add(route)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // every path below prefix is a file below dir
+    void Mount(std::string_view prefix, const std::string& dir);
+
+    void Dispatch(Exchange& exchange) const;
+
+    // whether Dispatch would hand the request to a route or a mount rather than answer 404 or 405
+    bool Takes(Method method, std::string_view path) const;
+
+private:
+    struct Node {
+        // the literal segment, or the parameter name of a parameter node
+        std::string segment{};
+        std::vector<std::unique_ptr<Node>> children{};
+        std::unique_ptr<Node> param{};
+        std::array<const Route*, static_cast<std::size_t>(Method::COUNT)> routes{};
+        std::string mount{};
+        bool mounted{};
+    };
+
+    Router() = default;
+
+    Router(const Router& rhs) = delete;
+    Router& operator=(const Router& rhs) = delete;
+
+    // the next non-empty segment, repeated and trailing slashes are ignored
+    static std::string_view NextSegment(std::string_view& path);
+
+    Node* Insert(std::string_view pattern, std::size_t& numParams);
+
+    // the node at path or nullptr, mount is the deepest mount on the way, params and tail go to exchange if given
+    const Node* Lookup(std::string_view path, const Node*& mount, Exchange* exchange) const;
+
+    static void ServeStatic(Exchange& exchange, const std::string& dir);
+
+private:
+    Node root_{};
+    // nodes point at these copies
+    std::vector<std::unique_ptr<Route>> routes_{};
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,20 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef ROUTES_H
+#define ROUTES_H
+
+#include "router.h"
+
+namespace msv {
+
+namespace http {
+
+// The server's endpoints, new ones are added to the table in routes.cpp.
+// Anything else is a file below resDir.
+bool InstallRoutes(Router& router, const std::string& resDir);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef CONNECTION_TABLE_H
+#define CONNECTION_TABLE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "http/http_connection.h"
+#include "threadpool/threadpool.h"
+
+namespace msv {
+
+// Preallocated fd-indexed slab of connections. Every open and close bumps the slot generation,
+// so a handle (fd + generation) held by a queued event or a timer detects that its connection is gone.
+// Open slots have odd generations, so fds registered with a plain fd (generation 0) never match.
+// A worker holds its slot for the whole task, the reactor closes only slots it can take itself.
+class ConnectionTable {
+public:
+    using Handle = uint64_t;
+
+    explicit ConnectionTable(std::size_t capacity) : capacity_(capacity), slots_(std::make_unique<Slot[]>(capacity)) {}
+
+    ConnectionTable(const ConnectionTable& rhs) = delete;
+    ConnectionTable& operator=(const ConnectionTable& rhs) = delete;
+
+    std::size_t Capacity() const
+    {
+        return capacity_;
+    }
+
+    // start a new connection generation on fd, fd must be below Capacity()
+    Handle Open(int fd)
+    {
+        auto& slot = slots_[fd];
+        auto generation = (slot.generation.load(std::memory_order_acquire) + 1U) | 1U;
+        slot.generation.store(generation, std::memory_order_release);
+        return MakeHandle(fd, generation);
+    }
+
+    // invalidate every outstanding handle of fd, retiring a closed slot is a no-op
+    void Retire(int fd)
+    {
+        if (fd >= 0 && static_cast<std::size_t>(fd) < capacity_) {
+            auto& generation = slots_[fd].generation;
+            auto current = generation.load(std::memory_order_acquire);
+            while ((current & 1U) && !generation.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel)) {}
+        }
+    }
+
+    http::HttpConnection* operator[](int fd)
+    {
+        return &slots_[fd].conn;
+    }
+
+    // nullptr for stale handles
+    http::HttpConnection* Get(Handle handle)
+    {
+        auto fd = FdOf(handle);
+        if (fd < 0 || static_cast<std::size_t>(fd) >= capacity_) {
+            return nullptr;
+        }
+        auto& slot = slots_[fd];
+        auto generation = GenerationOf(handle);
+        if (!(generation & 1U) || slot.generation.load(std::memory_order_acquire) != generation) {
+            return nullptr;
+        }
+        return &slot.conn;
+    }
+
+    // worker side, waits out another holder of the slot; nullptr for stale handles
+    http::HttpConnection* Acquire(Handle handle)
+    {
+        if (Get(handle) == nullptr) {
+            return nullptr;
+        }
+        auto& inFlight = slots_[FdOf(handle)].inFlight;
+        while (inFlight.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        auto conn = Get(handle);
+        if (conn == nullptr) {
+            inFlight.store(false, std::memory_order_release);
+        }
+        return conn;
+    }
+
+    // reactor side, fails while a worker is inside the slot
+    bool TryAcquire(int fd)
+    {
+        return !slots_[fd].inFlight.exchange(true, std::memory_order_acquire);
+    }
+
+    void Release(int fd)
+    {
+        slots_[fd].inFlight.store(false, std::memory_order_release);
+    }
+
+    Handle HandleOf(int fd) const
+    {
+        return MakeHandle(fd, slots_[fd].generation.load(std::memory_order_acquire));
+    }
+
+    static Handle MakeHandle(int fd, uint32_t generation)
+    {
+        return (static_cast<Handle>(generation) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    static int FdOf(Handle handle)
+    {
+        return static_cast<int>(static_cast<uint32_t>(handle));
+    }
+
+    static uint32_t GenerationOf(Handle handle)
+    {
+        return static_cast<uint32_t>(handle >> 32);
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<uint32_t> generation{};
+        std::atomic<bool> inFlight{};
+        http::HttpConnection conn{};
+    };
+
+    std::size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+}
+
+#endif
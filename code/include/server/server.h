@@ -6,19 +6,27 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <unordered_map>
 #include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <memory>
 
 #include "db/mysqlpool.h"
+#include "db/async_mysql.h"
 #include "threadpool/threadpool.h"
 #include "epoller/epoller.h"
+#include "epoller/uring_poller.h"
 #include "http/http_connection.h"
+#include "http/auth_handler.h"
+#include "http/routes.h"
 #include "timeout.h"
+#include "connection_table.h"
 
 namespace msv {
 
 using namespace http;
-using UserMapping = std::unordered_map<int, HttpConnection>;
 
 struct ServerConfig {
     uint16_t serverPort{2333U};
@@ -28,11 +36,45 @@ struct ServerConfig {
     bool optLinger{false};
     uint32_t numThread{8U};
     MysqlConfig mysqlConfig{};
+    uint32_t numReactor{1U};
+    std::size_t fileCacheSize{FileCache::DEFAULT_CAPACITY};
+    std::size_t sendfileThreshold{FileCache::DEFAULT_SENDFILE_THRESHOLD};
+    bool asyncDb{false};
+    uint16_t numAsyncConnect{2U};
+    // the kernel caps it at net.core.somaxconn
+    int listenBacklog{4096};
+    // connections one reactor accepts per readiness event before serving others
+    uint32_t acceptBudget{64U};
+    // io_uring needs ownedConnections, it falls back to epoll without them or when the kernel cannot provide it
+    PollerType pollerType{PollerType::EPOLL};
+    // connections stay on the reactor that accepted them, registered once edge triggered and served inline,
+    // blocking work (sync db verification, file loads on a cache miss) then runs on the reactor, pair it with asyncDb
+    bool ownedConnections{false};
+    // request bodies beyond this are answered with 413
+    std::size_t maxBodySize{RequestParser::DEFAULT_MAX_BODY_SIZE};
+};
+
+class Server;
+
+// One event loop: its own listening socket, epoll instance and the timers of the connections it accepted.
+struct Reactor {
+    Server* server{};
+    int sfd{-1};
+    std::unique_ptr<Poller> poller{};
+    // the poller accepts and receives by itself, connections are then never read directly
+    bool ringDriven{};
+    TimingWheel timingWheel{};
+    AsyncMysql asyncMysql{};
 };
 
 class Server {
 public:
     static constexpr std::size_t MAX_CONNECTION_NUM = 65535U;
+    // descriptors below this are not connections: std streams, listeners, epoll, inotify, mysql
+    static constexpr std::size_t RESERVED_FD_NUM = 1024U;
+    static constexpr uint32_t MAX_REACTOR_COUNT = 64U;
+    static constexpr std::string_view BUSY_RESPONSE =
+        "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
 
 public:
     Server(ServerConfig config);
@@ -46,22 +88,49 @@ public:
 
     void Shutdown()
     {
-        close(sfd_);
         shutdown_ = true;
+        for (auto& reactor : reactors_) {
+            if (reactor->sfd >= 0) {
+                close(reactor->sfd);
+                reactor->sfd = -1;
+            }
+        }
         threadPool_.Shutdown();
     }
 
-    void ReadEntry(HttpConnection* conn);
-    void ProcessEntry(HttpConnection* conn);
-    void WriteEntry(HttpConnection* conn);
+    void Loop(Reactor* reactor);
+
+    // thread pool trampolines: owner is the reactor, arg the connection handle
+    static void OnRead(void* owner, uintptr_t arg);
+    static void OnWrite(void* owner, uintptr_t arg);
+    static void OnResume(void* owner, uintptr_t arg);
+
+    // AsyncMysql completion, runs on the reactor thread
+    static void OnVerified(void* owner, uint64_t handle, bool success);
 
-    void CloseConnection(HttpConnection* conn);
+    void ReadEntry(Reactor* reactor, HttpConnection* conn);
+    void ProcessEntry(Reactor* reactor, HttpConnection* conn);
+    void WriteEntry(Reactor* reactor, HttpConnection* conn);
 
-    void SendError(int cfd, const char* info) const;
+    // ownership mode, everything below runs on the reactor thread
+    void HandleOwned(Reactor* reactor, HttpConnection* conn, uint32_t events);
+    void HandleReceived(Reactor* reactor, HttpConnection* conn, int result, std::string_view data);
+    void ResumeReceive(Reactor* reactor, HttpConnection* conn);
+    void Serve(Reactor* reactor, HttpConnection* conn);
+    void SetWriteInterest(Reactor* reactor, HttpConnection* conn, bool enable);
 
-    void Listen();
+    void CloseConnection(Reactor* reactor, HttpConnection* conn);
+    // closes on behalf of the reactor, a slot a worker is inside is retried a tick later
+    void CloseFromReactor(Reactor* reactor, ConnectionTable::Handle handle, bool timedOut);
 
-    bool InitializeSocket();
+    // best effort, the socket is non-blocking and closed right after
+    void SendError(int cfd, std::string_view info) const;
+
+    void Listen(Reactor* reactor);
+    void Accept(Reactor* reactor, int cfd, const struct sockaddr_in& addr);
+
+    bool InitializePoller(Reactor* reactor, PollerType type);
+    bool InitializeSocket(Reactor* reactor);
     void InitializeEvents();
 
 private:
@@ -70,17 +139,22 @@ private:
     TriggerMode cnTrigMode_;
     TimeStamp cnTimeout_;
     bool optLinger_;
-    bool shutdown_;
+    int listenBacklog_;
+    uint32_t acceptBudget_;
+    bool ownedConnections_;
+    std::atomic<bool> shutdown_{};
 
-    int sfd_;
     uint32_t listenEvents_;
     uint32_t connectionEvents_;
+    uint32_t ownedEvents_;
+    uint32_t ringEvents_;
 
-    TimeNodeHeap timeNodeHeap_;
     ThreadPool threadPool_;
-    Epoller epoller_;
 
-    UserMapping userMapping_;
+    ConnectionTable connections_{MAX_CONNECTION_NUM + RESERVED_FD_NUM};
+
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::vector<std::thread> reactorThreads_;
 };
 
 }
@@ -3,9 +3,11 @@
 #ifndef TIMEOUT_H
 #define TIMEOUT_H
 
+#include <array>
+#include <algorithm>
+#include <vector>
 #include <chrono>
 #include <functional>
-#include <unordered_map>
 #include <cassert>
 
 #include "utils/mlog.h"
@@ -18,20 +20,25 @@ using TimeStamp = int64_t;
 using TimeoutCallbackFuncType = std::function<void()>;
 
 struct TimeNode {
-    int cfd;
-    TimeStamp expire;
-    TimeoutCallbackFuncType callback;
-
-    bool operator<(const TimeNode& rhs) const
-    {
-        return expire < rhs.expire;
-    }
+    int prev{-1};
+    int next{-1};
+    // tick of the slot the node is linked into, -1 when not scheduled
+    int64_t tick{-1};
+    TimeStamp expire{};
+    TimeoutCallbackFuncType callback{};
 };
 
-class TimeNodeHeap {
+// Hashed timing wheel keyed by fd. Insert/Modify/Remove are O(1); Modify only moves the deadline
+// and the node is re-slotted lazily when its old slot comes due, so busy connections cost no relinking.
+// Time is monotonic; GetMinTimeout fires due slots and reports the delay to the next occupied slot.
+class TimingWheel {
+public:
+    static constexpr TimeStamp TICK_MS = 100;
+    static constexpr std::size_t WHEEL_SIZE = 512U;
+
 public:
-    TimeNodeHeap() = default;
-    ~TimeNodeHeap() = default;
+    TimingWheel();
+    ~TimingWheel() = default;
 
     void Insert(int cfd, TimeStamp timeout, TimeoutCallbackFuncType&& callback);
     void Modify(int cfd, TimeStamp timeout);
@@ -40,43 +47,45 @@ public:
     TimeStamp GetMinTimeout();
 
 private:
-    bool AdjustDown(std::size_t index);
-    void AdjustUp(std::size_t index);
-    void Remove(std::size_t index);
-
-    const TimeNode& Top() const
+    static int64_t TickOf(TimeStamp expire)
     {
-        return data_[0];
+        // round up so a node never fires before its deadline
+        return (expire + TICK_MS - 1) / TICK_MS;
     }
 
-    void Pop()
+    static std::size_t SlotOf(int64_t tick)
     {
-        Remove(0UL);
+        return static_cast<std::size_t>(tick) % WHEEL_SIZE;
     }
 
-    bool Empty() const
-    {
-        return data_.empty();
-    }
+    void Link(int cfd, int64_t tick);
+    void Unlink(int cfd);
 
-    void Clean();
+    void Advance();
+
+    TimeStamp NextTimeout() const;
 
     static TimeStamp Now()
     {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
     }
 
 private:
-    std::vector<TimeNode> data_;
-    std::unordered_map<int, std::size_t> userMapping_;
+    TimeStamp now_{};
+    int64_t currentTick_{};
+    std::size_t count_{};
+
+    std::vector<TimeNode> nodes_;
+    std::array<int, WHEEL_SIZE> heads_{};
+    std::array<uint64_t, WHEEL_SIZE / 64> occupied_{};
 };
 
 }
 
-using timeout::TimeNodeHeap;
+using timeout::TimingWheel;
 using timeout::TimeoutCallbackFuncType;
 using timeout::TimeStamp;
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -4,75 +4,267 @@
 #define THREADPOOL_H
 
 #include <mutex>
-#include <queue>
-#include <functional>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstring>
 #include <thread>
+#include <type_traits>
 #include <condition_variable>
 
 namespace msv {
 
-class TaskQueue {
+static constexpr std::size_t CACHE_LINE_SIZE = 64U;
+
+// Fixed-size task record: a plain function plus two words of context, copied by value so dispatch never allocates.
+struct Task {
+    using FuncType = void (*)(void* owner, uintptr_t arg);
+
+    FuncType func{};
+    void* owner{};
+    uintptr_t arg{};
+
+    void operator()() const
+    {
+        func(owner, arg);
+    }
+};
+
+// Bounded multi-producer multi-consumer queue (Vyukov). Capacity is rounded up to a power of two.
+template<typename T>
+class BoundedQueue {
 public:
-    using TaskType = std::function<void()>;
+    explicit BoundedQueue(std::size_t capacity)
+    {
+        std::size_t size = 2U;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
 
-    bool shutdown_{};
-    std::mutex mutex_{};
-    std::condition_variable cond_{};
-    std::queue<TaskType> queue_{};
+    BoundedQueue(const BoundedQueue& rhs) = delete;
+    BoundedQueue& operator=(const BoundedQueue& rhs) = delete;
 
-    void Shutdown()
+    bool Push(T value)
     {
-        {
-            std::lock_guard locker(mutex_);
-            shutdown_ = true;
+        auto pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& cell = cells_[pos & mask_];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
         }
-        cond_.notify_all();
     }
 
-    void AddTask(TaskType&& task)
+    bool Pop(T& value)
     {
-        {
-            std::lock_guard locker(mutex_);
-            queue_.push(std::move(task));
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& cell = cells_[pos & mask_];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.data);
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool Empty() const
+    {
+        return enqueuePos_.load(std::memory_order_acquire) == dequeuePos_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence{};
+        T data{};
+    };
+
+    std::size_t mask_{};
+    std::unique_ptr<Cell[]> cells_{};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> enqueuePos_{};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> dequeuePos_{};
+};
+
+// Fixed-capacity Chase-Lev deque: the owner pushes and pops at the bottom, thieves steal from the top.
+// A thief may read a slot the owner is overwriting and then discards it, so T is kept in word-sized atomics.
+template<typename T>
+class WorkStealingDeque {
+public:
+    static constexpr std::size_t CAPACITY = 256U;
+
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(uintptr_t) == 0);
+
+    // owner only
+    bool Push(T value)
+    {
+        auto bottom = bottom_.load(std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_acquire);
+        if (bottom - top >= static_cast<int64_t>(CAPACITY)) {
+            return false;
+        }
+        slots_[bottom & (CAPACITY - 1)].Store(value);
+        bottom_.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    // owner only
+    bool Pop(T& value)
+    {
+        auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_seq_cst);
+        auto top = top_.load(std::memory_order_seq_cst);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        value = slots_[bottom & (CAPACITY - 1)].Load();
+        if (top == bottom) {
+            // last item, race the thieves for it
+            auto won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return won;
         }
-        cond_.notify_one();
+        return true;
     }
+
+    bool Steal(T& value)
+    {
+        auto top = top_.load(std::memory_order_seq_cst);
+        auto bottom = bottom_.load(std::memory_order_seq_cst);
+        if (top >= bottom) {
+            return false;
+        }
+        value = slots_[top & (CAPACITY - 1)].Load();
+        return top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    std::size_t Size() const
+    {
+        auto size = bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed);
+        return size > 0 ? static_cast<std::size_t>(size) : 0U;
+    }
+
+private:
+    struct Slot {
+        static constexpr std::size_t NUM_WORDS = sizeof(T) / sizeof(uintptr_t);
+
+        std::atomic<uintptr_t> words[NUM_WORDS]{};
+
+        void Store(const T& value)
+        {
+            uintptr_t buffer[NUM_WORDS];
+            std::memcpy(buffer, &value, sizeof(T));
+            for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+        }
+
+        T Load() const
+        {
+            uintptr_t buffer[NUM_WORDS];
+            for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            T value;
+            std::memcpy(&value, buffer, sizeof(T));
+            return value;
+        }
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top_{};
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom_{};
+    Slot slots_[CAPACITY]{};
 };
 
+// Work-stealing pool: external threads feed a bounded injection queue, workers pull batches of it
+// into their own deques and steal from each other when they run dry. Idle workers spin briefly, then park.
 class ThreadPool {
 public:
-    static constexpr uint32_t MAX_THREAD_COUNT = 16U;
+    using TaskType = Task;
+
+    static constexpr uint32_t MAX_THREAD_COUNT = 128U;
+    static constexpr std::size_t INJECTION_CAPACITY = 65536U;
+    static constexpr std::size_t BATCH_SIZE = 32U;
+    static constexpr uint32_t SPIN_COUNT = 64U;
 
 public:
-    ThreadPool () = default;
+    ThreadPool() = default;
 
     ThreadPool(const ThreadPool& rhs) = delete;
     ThreadPool& operator=(const ThreadPool& rhs) = delete;
 
     ~ThreadPool()
     {
-        if (taskQueue_) {
-            taskQueue_->Shutdown();
-        }
+        Shutdown();
     }
 
-    void Shutdown()
-    {
-        taskQueue_->Shutdown();
-    }
+    void Initialize(uint32_t threadCount);
+
+    void Shutdown();
+
+    void AddTask(TaskType task);
 
-    void AddTask(TaskQueue::TaskType&& task)
+    // the number of workers actually started
+    uint32_t GetThreadCount() const
     {
-        taskQueue_->AddTask(std::move(task));
+        return threadCount_;
     }
 
-    void Initialize(uint32_t threadCount);
+private:
+    struct alignas(CACHE_LINE_SIZE) Worker {
+        WorkStealingDeque<TaskType> deque{};
+        std::thread thread{};
+    };
+
+    void Run(std::size_t index);
+
+    bool FindTask(std::size_t index, TaskType& task);
+
+    bool HasWork() const;
+
+    void Park();
+    void Wake();
 
 private:
-    uint32_t threadCount_;
-    std::shared_ptr<TaskQueue> taskQueue_;
+    uint32_t threadCount_{};
+    std::atomic<bool> shutdown_{};
+
+    std::unique_ptr<BoundedQueue<TaskType>> injection_{};
+    std::vector<std::unique_ptr<Worker>> workers_{};
+
+    std::mutex parkMutex_{};
+    std::condition_variable parkCond_{};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> numSleeping_{};
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
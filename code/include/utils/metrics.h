@@ -0,0 +1,233 @@
+// Author: cute-giggle@outlook.com
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace msv {
+
+enum class Counter : uint8_t {
+    ACCEPTS = 0U,
+    REQUESTS,
+    BYTES_IN,
+    BYTES_OUT,
+    PARSE_ERRORS,
+    RESPONSES_4XX,
+    RESPONSES_5XX,
+    TIMEOUTS,
+    COUNT,
+};
+
+enum class Histogram : uint8_t {
+    PARSE = 0U,
+    PROCESS,
+    WRITE,
+    DB,
+    COUNT,
+};
+
+// Process wide counters and latency histograms. Every thread writes only its own cache-line aligned block
+// with plain relaxed stores, the blocks are summed when /metrics is scraped.
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+    using GaugeFuncType = std::function<double()>;
+
+    // bucket i counts samples up to 2^i microseconds, the last one is +Inf
+    static constexpr std::size_t BUCKET_COUNT = 26U;
+
+    static Metrics* Instance()
+    {
+        static Metrics metrics;
+        return &metrics;
+    }
+
+    static void Add(Counter counter, uint64_t value = 1U)
+    {
+        Bump(Local().counters[static_cast<std::size_t>(counter)], value);
+    }
+
+    static void Observe(Histogram histogram, Clock::duration duration)
+    {
+        auto micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+        auto& block = Local().histograms[static_cast<std::size_t>(histogram)];
+        Bump(block.buckets[BucketOf(micros)], 1U);
+        Bump(block.sum, micros);
+    }
+
+    static void Observe(Histogram histogram, Clock::time_point start)
+    {
+        Observe(histogram, Clock::now() - start);
+    }
+
+    // values sampled at scrape time, e.g. the number of open connections
+    void AddGauge(std::string name, std::string help, GaugeFuncType func)
+    {
+        std::lock_guard locker(mutex_);
+        gauges_.push_back({std::move(name), std::move(help), std::move(func)});
+    }
+
+    // Totals of one scrape, taken at once so that the sections rendered from them agree.
+    struct Snapshot {
+        uint64_t counters[static_cast<std::size_t>(Counter::COUNT)]{};
+        uint64_t buckets[static_cast<std::size_t>(Histogram::COUNT)][BUCKET_COUNT]{};
+        uint64_t sums[static_cast<std::size_t>(Histogram::COUNT)]{};
+        std::string gauges{};
+    };
+
+    // the gauges, then one section per counter and per histogram
+    static constexpr std::size_t SECTION_COUNT = 1U + static_cast<std::size_t>(Counter::COUNT) + static_cast<std::size_t>(Histogram::COUNT);
+
+    Snapshot Collect();
+
+    // appends section index of the Prometheus text exposition format
+    static void RenderSection(const Snapshot& snapshot, std::size_t index, std::string& out);
+
+    std::string Render()
+    {
+        auto snapshot = Collect();
+        std::string out;
+        for (std::size_t i = 0; i < SECTION_COUNT; ++i) {
+            RenderSection(snapshot, i, out);
+        }
+        return out;
+    }
+
+private:
+    struct HistogramBlock {
+        std::atomic<uint64_t> buckets[BUCKET_COUNT]{};
+        std::atomic<uint64_t> sum{};
+    };
+
+    struct alignas(64) ThreadBlock {
+        std::atomic<uint64_t> counters[static_cast<std::size_t>(Counter::COUNT)]{};
+        HistogramBlock histograms[static_cast<std::size_t>(Histogram::COUNT)]{};
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string help;
+        GaugeFuncType func;
+    };
+
+    Metrics() = default;
+
+    Metrics(const Metrics& rhs) = delete;
+    Metrics& operator=(const Metrics& rhs) = delete;
+
+    // single writer, no read-modify-write needed
+    static void Bump(std::atomic<uint64_t>& value, uint64_t delta)
+    {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    static std::size_t BucketOf(uint64_t micros)
+    {
+        auto bits = micros <= 1U ? 0U : static_cast<std::size_t>(64 - __builtin_clzll(micros - 1));
+        return std::min(bits, BUCKET_COUNT - 1);
+    }
+
+    // blocks outlive their threads so totals never go backwards
+    static ThreadBlock& Local()
+    {
+        thread_local ThreadBlock* block = Instance()->Register();
+        return *block;
+    }
+
+    ThreadBlock* Register()
+    {
+        std::lock_guard locker(mutex_);
+        blocks_.push_back(std::make_unique<ThreadBlock>());
+        return blocks_.back().get();
+    }
+
+private:
+    std::mutex mutex_{};
+    std::vector<std::unique_ptr<ThreadBlock>> blocks_{};
+    std::vector<Gauge> gauges_{};
+};
+
+inline Metrics::Snapshot Metrics::Collect()
+{
+    static constexpr auto numCounter = static_cast<std::size_t>(Counter::COUNT);
+    static constexpr auto numHistogram = static_cast<std::size_t>(Histogram::COUNT);
+
+    Snapshot snapshot;
+    char value[32]{};
+    std::lock_guard locker(mutex_);
+    for (const auto& block : blocks_) {
+        for (std::size_t i = 0; i < numCounter; ++i) {
+            snapshot.counters[i] += block->counters[i].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < numHistogram; ++i) {
+            for (std::size_t j = 0; j < BUCKET_COUNT; ++j) {
+                snapshot.buckets[i][j] += block->histograms[i].buckets[j].load(std::memory_order_relaxed);
+            }
+            snapshot.sums[i] += block->histograms[i].sum.load(std::memory_order_relaxed);
+        }
+    }
+    for (const auto& gauge : gauges_) {
+        snapshot.gauges += "# HELP " + gauge.name + " " + gauge.help + "\n# TYPE " + gauge.name + " gauge\n";
+        snprintf(value, sizeof(value), "%.9g", gauge.func());
+        snapshot.gauges += gauge.name + " " + value + "\n";
+    }
+    return snapshot;
+}
+
+inline void Metrics::RenderSection(const Snapshot& snapshot, std::size_t index, std::string& out)
+{
+    static constexpr const char* counterNames[] = {
+        "msv_accepts_total", "msv_requests_total", "msv_bytes_received_total", "msv_bytes_sent_total",
+        "msv_parse_errors_total", "msv_responses_4xx_total", "msv_responses_5xx_total", "msv_timeouts_total",
+    };
+    static constexpr const char* histogramNames[] = {
+        "msv_parse_seconds", "msv_process_seconds", "msv_write_seconds", "msv_db_seconds",
+    };
+    static constexpr auto numCounter = static_cast<std::size_t>(Counter::COUNT);
+
+    if (index == 0) {
+        out += snapshot.gauges;
+        return;
+    }
+    if (index <= numCounter) {
+        std::string name = counterNames[index - 1];
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + std::to_string(snapshot.counters[index - 1]) + "\n";
+        return;
+    }
+    auto i = index - 1 - numCounter;
+    if (i >= static_cast<std::size_t>(Histogram::COUNT)) {
+        return;
+    }
+
+    char value[32]{};
+    char bound[32]{};
+    std::string name = histogramNames[i];
+    out += "# TYPE " + name + " histogram\n";
+    uint64_t cumulative = 0;
+    for (std::size_t j = 0; j < BUCKET_COUNT; ++j) {
+        cumulative += snapshot.buckets[i][j];
+        if (j + 1 == BUCKET_COUNT) {
+            snprintf(bound, sizeof(bound), "+Inf");
+        }
+        else {
+            snprintf(bound, sizeof(bound), "%g", static_cast<double>(1ULL << j) / 1e6);
+        }
+        out += name + "_bucket{le=\"" + bound + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    snprintf(value, sizeof(value), "%.9g", static_cast<double>(snapshot.sums[i]) / 1e6);
+    out += name + "_sum " + value + "\n";
+    out += name + "_count " + std::to_string(cumulative) + "\n";
+}
+}
+
+#endif
@@ -5,6 +5,9 @@
 
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
 #include <filesystem>
 #include <string>
 #include <vector>
@@ -13,6 +16,14 @@
 #include <fstream>
 #include <memory>
 #include <iostream>
+#include <type_traits>
+#include <cstring>
+#include <ctime>
+
+// Calls below this level are compiled out, 0 keeps everything (see Level).
+#ifndef MLOG_MIN_LEVEL
+#define MLOG_MIN_LEVEL 0
+#endif
 
 namespace mlog
 {
@@ -22,6 +33,31 @@ class Stream
 public:
     virtual void write(const std::string& msg) noexcept = 0;
 
+    // a batch of newline terminated messages from the async backend
+    virtual void writeBlock(std::string_view block) noexcept
+    {
+        while (!block.empty())
+        {
+            auto pos = block.find('\n');
+            write(std::string(block.substr(0, pos)));
+            if (pos == std::string_view::npos)
+            {
+                break;
+            }
+            block.remove_prefix(pos + 1);
+        }
+    }
+
+    // binary records may hold newline bytes themselves, so the block goes out in one piece
+    // and write puts back the newline that ends its last record
+    virtual void writeBinaryBlock(std::string_view block) noexcept
+    {
+        if (!block.empty())
+        {
+            write(std::string(block.substr(0, block.size() - 1)));
+        }
+    }
+
     virtual ~Stream() = default;
 };
 
@@ -33,6 +69,16 @@ public:
         std::cout << msg << std::endl;
     }
 
+    void writeBlock(std::string_view block) noexcept override
+    {
+        std::cout.write(block.data(), block.size()).flush();
+    }
+
+    void writeBinaryBlock(std::string_view block) noexcept override
+    {
+        writeBlock(block);
+    }
+
     virtual ~ConsoleStream() = default;
 };
 
@@ -60,6 +106,25 @@ public:
         output_ << msg << std::endl;
     }
 
+    void writeBlock(std::string_view block) noexcept override
+    {
+        if (output_.fail())
+        {
+            return;
+        }
+        if (output_.tellp() > capacity_)
+        {
+            output_.close();
+            output_.open(path_, std::ios::out | std::ios::trunc);
+        }
+        output_.write(block.data(), block.size()).flush();
+    }
+
+    void writeBinaryBlock(std::string_view block) noexcept override
+    {
+        writeBlock(block);
+    }
+
 private:
     uint32_t capacity_{};
     std::filesystem::path path_;
@@ -76,6 +141,146 @@ enum class Level
     L_CLOSE,
 };
 
+inline const char* levelName(Level level) noexcept
+{
+    static constexpr const char* names[] = {"DEBUG", "INFOR", "WARNN", "ERROR", "FATAL", "CLOSE"};
+    return names[static_cast<int>(level)];
+}
+
+enum class Format
+{
+    TEXT,
+    BINARY,
+};
+
+// Binary records, native byte order, each followed by a newline like text messages:
+// magic(u16) level(u8) argc(u8) time_ns(u64) line(u32) file_len(u16) file, then argc tagged values.
+namespace binary
+{
+
+static constexpr uint16_t MAGIC = 0x4C4DU;
+
+enum class Tag : uint8_t
+{
+    INT = 0U,       // i64
+    UINT,           // u64
+    REAL,           // f64
+    BOOL,           // u8
+    STRING,         // u32 length + bytes
+};
+
+template<typename T>
+inline void put(std::string& out, T value) noexcept
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+inline void encode(std::string& out, const T& value) noexcept
+{
+    using D = std::decay_t<T>;
+    if constexpr (std::is_same_v<D, bool>)
+    {
+        put(out, Tag::BOOL);
+        put<uint8_t>(out, value);
+    }
+    else if constexpr (std::is_same_v<D, char>)
+    {
+        put(out, Tag::STRING);
+        put<uint32_t>(out, 1U);
+        out.push_back(value);
+    }
+    else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>)
+    {
+        put(out, Tag::INT);
+        put<int64_t>(out, value);
+    }
+    else if constexpr (std::is_integral_v<D>)
+    {
+        put(out, Tag::UINT);
+        put<uint64_t>(out, value);
+    }
+    else if constexpr (std::is_floating_point_v<D>)
+    {
+        put(out, Tag::REAL);
+        put<double>(out, value);
+    }
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+    {
+        std::string_view view = value;
+        put(out, Tag::STRING);
+        put<uint32_t>(out, view.size());
+        out.append(view);
+    }
+    else
+    {
+        std::ostringstream buffer;
+        buffer << value;
+        encode(out, buffer.str());
+    }
+}
+
+}
+
+// Single producer single consumer byte ring owned by one logging thread, drained by the flusher.
+class StagingBuffer
+{
+public:
+    static constexpr std::size_t CAPACITY = 1U << 20;
+
+    StagingBuffer() noexcept : data_(new char[CAPACITY]) {}
+
+    StagingBuffer(const StagingBuffer&) = delete;
+    StagingBuffer& operator= (const StagingBuffer&) = delete;
+
+    // appends msg and a newline, false when there is not enough room
+    bool push(std::string_view msg) noexcept
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto tail = tail_.load(std::memory_order_acquire);
+        if (msg.size() + 1 > CAPACITY - (head - tail))
+        {
+            return false;
+        }
+        copyIn(head, msg.data(), msg.size());
+        copyIn(head + msg.size(), "\n", 1);
+        head_.store(head + msg.size() + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+    }
+
+    void drain(std::string& out) noexcept
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        while (tail != head)
+        {
+            auto offset = tail % CAPACITY;
+            auto length = std::min(head - tail, CAPACITY - offset);
+            out.append(data_.get() + offset, length);
+            tail += length;
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+private:
+    void copyIn(std::size_t pos, const char* src, std::size_t length) noexcept
+    {
+        auto offset = pos % CAPACITY;
+        auto first = std::min(length, CAPACITY - offset);
+        std::copy_n(src, first, data_.get() + offset);
+        std::copy_n(src + first, length - first, data_.get());
+    }
+
+    std::unique_ptr<char[]> data_;
+    alignas(64) std::atomic<std::size_t> head_{};
+    alignas(64) std::atomic<std::size_t> tail_{};
+};
+
 class Collection
 {
 public:
@@ -85,6 +290,11 @@ public:
         return instance_;
     }
 
+    ~Collection()
+    {
+        stopAsync();
+    }
+
     void setLevel(Level newLevel) noexcept
     {
         level_ = newLevel;
@@ -95,23 +305,95 @@ public:
         return level_;
     }
 
+    bool enabled(Level level) const noexcept
+    {
+        return level >= level_;
+    }
+
+    // binary output is meant for ConsoleStream and FileStream, decode it with mlog_decode
+    void setFormat(Format format) noexcept
+    {
+        format_ = format;
+    }
+
     void addStream(std::shared_ptr<Stream>&& stream) noexcept
     {
         std::lock_guard<std::mutex> lock(mtx_);
         list_.emplace_back(std::move(stream));
     }
 
+    // hand messages to per-thread staging buffers, a background thread writes them in blocks every interval
+    void startAsync(std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100)) noexcept
+    {
+        std::lock_guard<std::mutex> lock(flushMtx_);
+        if (async_)
+        {
+            return;
+        }
+        flushInterval_ = flushInterval;
+        stopping_ = false;
+        flusher_ = std::thread(&Collection::flushLoop, this);
+        async_ = true;
+    }
+
+    void stopAsync() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(flushMtx_);
+            if (!async_)
+            {
+                return;
+            }
+            async_ = false;
+            stopping_ = true;
+        }
+        flushCond_.notify_one();
+        flusher_.join();
+    }
+
     template<Level L, typename... Args>
-    void write(Args&&... args) noexcept
+    void write(const char* file, uint32_t line, Args&&... args) noexcept
     {
-        if (L >= level_)
+        if (L < level_)
         {
-            std::stringstream buffer;
-            (buffer << ... << std::forward<Args>(args));
-            auto operation = [&buffer](std::shared_ptr<Stream>& stream) { stream->write(buffer.str()); };
-            std::lock_guard<std::mutex> lock(mtx_);
-            std::for_each(list_.begin(), list_.end(), operation);
+            return;
+        }
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+        if (format_ == Format::BINARY)
+        {
+            thread_local std::string record;
+            record.clear();
+            binary::put(record, binary::MAGIC);
+            binary::put(record, static_cast<uint8_t>(L));
+            binary::put(record, static_cast<uint8_t>(sizeof...(args)));
+            binary::put(record, static_cast<uint64_t>(nanoseconds));
+            binary::put(record, line);
+            binary::put(record, static_cast<uint16_t>(strlen(file)));
+            record.append(file);
+            (binary::encode(record, args), ...);
+            commit(record);
+            return;
         }
+
+        thread_local std::ostringstream buffer;
+        buffer.str({});
+        buffer << levelName(L) << ": " << timestamp(nanoseconds) << ": " << file << ":" << line << ": ";
+        (buffer << ... << std::forward<Args>(args));
+        commit(buffer.str());
+    }
+
+    // local time with milliseconds, the text format and mlog_decode share it
+    static std::string timestamp(int64_t nanoseconds) noexcept
+    {
+        auto seconds = static_cast<time_t>(nanoseconds / 1000000000);
+        struct tm local{};
+        localtime_r(&seconds, &local);
+        char buffer[32]{};
+        auto length = strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+        snprintf(buffer + length, sizeof(buffer) - length, ".%03d", static_cast<int>(nanoseconds / 1000000 % 1000));
+        return buffer;
     }
 
 private:
@@ -120,9 +402,107 @@ private:
     Collection(const Collection&) = delete;
     Collection& operator= (const Collection&) = delete;
 
+    void commit(const std::string& msg) noexcept
+    {
+        // a message the staging buffer could never hold is written directly
+        if (!async_ || msg.size() >= StagingBuffer::CAPACITY)
+        {
+            writeDirect(msg);
+            return;
+        }
+
+        auto& staging = localStaging();
+        while (!staging.push(msg))
+        {
+            // no flusher left to make room
+            if (!async_)
+            {
+                writeDirect(msg);
+                return;
+            }
+            // full, wait for the flusher instead of dropping the message
+            flushCond_.notify_one();
+            std::this_thread::yield();
+        }
+        if (staging.size() > StagingBuffer::CAPACITY / 2)
+        {
+            flushCond_.notify_one();
+        }
+    }
+
+    void writeDirect(const std::string& msg) noexcept
+    {
+        auto operation = [&msg](std::shared_ptr<Stream>& stream) { stream->write(msg); };
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::for_each(list_.begin(), list_.end(), operation);
+    }
+
+    StagingBuffer& localStaging() noexcept
+    {
+        thread_local std::shared_ptr<StagingBuffer> staging = [this]()
+        {
+            auto ptr = std::make_shared<StagingBuffer>();
+            std::lock_guard<std::mutex> lock(stagingMtx_);
+            stagings_.push_back(ptr);
+            return ptr;
+        }();
+        return *staging;
+    }
+
+    void flushLoop() noexcept
+    {
+        // staging buffers are the front buffers, producers never wait on the streams while block is written out
+        std::string block;
+        while (true)
+        {
+            bool stopping = false;
+            {
+                std::unique_lock<std::mutex> lock(flushMtx_);
+                flushCond_.wait_for(lock, flushInterval_);
+                stopping = stopping_;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stagingMtx_);
+                for (auto& staging : stagings_)
+                {
+                    staging->drain(block);
+                }
+                // buffers of exited threads are empty once drained
+                stagings_.erase(std::remove_if(stagings_.begin(), stagings_.end(), [](const std::shared_ptr<StagingBuffer>& staging) { return staging.use_count() == 1 && staging->size() == 0; }), stagings_.end());
+            }
+            if (!block.empty())
+            {
+                auto binary = format_ == Format::BINARY;
+                auto operation = [&block, binary](std::shared_ptr<Stream>& stream)
+                {
+                    binary ? stream->writeBinaryBlock(block) : stream->writeBlock(block);
+                };
+                std::lock_guard<std::mutex> lock(mtx_);
+                std::for_each(list_.begin(), list_.end(), operation);
+                block.clear();
+            }
+            if (stopping)
+            {
+                return;
+            }
+        }
+    }
+
     std::mutex mtx_;
     std::atomic<Level> level_;
+    std::atomic<Format> format_{Format::TEXT};
     std::vector<std::shared_ptr<Stream>> list_;
+
+    std::atomic<bool> async_{};
+    std::mutex flushMtx_;
+    std::condition_variable flushCond_;
+    std::chrono::milliseconds flushInterval_{100};
+    bool stopping_{};
+    std::thread flusher_;
+
+    std::mutex stagingMtx_;
+    std::vector<std::shared_ptr<StagingBuffer>> stagings_;
 };
 
 template<typename... Args>
@@ -136,16 +516,27 @@ inline std::string format(const char* fmt, Args&&... args) noexcept
 
 }
 
-#define MLOG_EXT_INFO __DATE__, ": ", __TIME__, ": ", __FILE__, ":", __LINE__, ": "
+// Arguments are evaluated only when the level is enabled, calls under MLOG_MIN_LEVEL are not compiled in.
+#define MLOG_WRITE(level, msg...)                                                               \
+    do                                                                                          \
+    {                                                                                           \
+        if constexpr (static_cast<int>(level) >= MLOG_MIN_LEVEL)                                \
+        {                                                                                       \
+            if (auto& collection_ = mlog::Collection::instance(); collection_.enabled(level))  \
+            {                                                                                   \
+                collection_.write<level>(__FILE__, __LINE__, msg);                              \
+            }                                                                                   \
+        }                                                                                       \
+    } while (0)
 
-#define MLOG_DEBUG(msg...) mlog::Collection::instance().write<mlog::Level::L_DEBUG>("DEBUG: ", MLOG_EXT_INFO, msg)
+#define MLOG_DEBUG(msg...) MLOG_WRITE(mlog::Level::L_DEBUG, msg)
 
-#define MLOG_INFOR(msg...) mlog::Collection::instance().write<mlog::Level::L_INFOR>("INFOR: ", MLOG_EXT_INFO, msg)
+#define MLOG_INFOR(msg...) MLOG_WRITE(mlog::Level::L_INFOR, msg)
 
-#define MLOG_WARNN(msg...) mlog::Collection::instance().write<mlog::Level::L_WARNN>("WARNN: ", MLOG_EXT_INFO, msg)
+#define MLOG_WARNN(msg...) MLOG_WRITE(mlog::Level::L_WARNN, msg)
 
-#define MLOG_ERROR(msg...) mlog::Collection::instance().write<mlog::Level::L_ERROR>("ERROR: ", MLOG_EXT_INFO, msg)
+#define MLOG_ERROR(msg...) MLOG_WRITE(mlog::Level::L_ERROR, msg)
 
-#define MLOG_FATAL(msg...) mlog::Collection::instance().write<mlog::Level::L_FATAL>("FATAL: ", MLOG_EXT_INFO, msg)
+#define MLOG_FATAL(msg...) MLOG_WRITE(mlog::Level::L_FATAL, msg)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+// Author: cute-giggle@outlook.com
+
+#include "http/auth_handler.h"
+#include "http/http_connection.h"
+
+namespace msv::http {
+
+bool AuthHandler::AsyncVerify = false;
+
+void AuthHandler::Handle(Exchange& exchange, bool isLogin)
+{
+    auto& request = exchange.Request();
+    if (request.GetHeader(HeaderField::CONTENT_TYPE) != "application/x-www-form-urlencoded" || !request.DecodeForm()) {
+        exchange.RespondError(400);
+        return;
+    }
+    auto username = request.GetFormValue("username");
+    auto password = request.GetFormValue("password");
+    if (!username.has_value() || !password.has_value()) {
+        exchange.RespondError(400);
+        return;
+    }
+
+    Credentials credentials{isLogin, username.value(), password.value()};
+    auto success = false;
+    if (VerifyCached(credentials, success)) {
+        Finish(exchange, success);
+        return;
+    }
+    if (AsyncVerify) {
+        exchange.Defer(&AuthHandler::Resume, credentials);
+        return;
+    }
+    Finish(exchange, Verify(credentials));
+}
+
+void AuthHandler::Finish(Exchange& exchange, bool success)
+{
+    exchange.ServeFile(HttpConnection::ResDir.string() + std::string(success ? SUCCESS_PAGE : FAILURE_PAGE));
+}
+
+bool AuthHandler::VerifyCached(const Credentials& credentials, bool& success)
+{
+    using Result = CredentialCache::Result;
+    auto result = CredentialCache::Instance()->Check(credentials.username, credentials.password);
+    if (result == Result::MISS) {
+        return false;
+    }
+    if (credentials.isLogin) {
+        success = result == Result::MATCH;
+        return true;
+    }
+    // a known user cannot register again, a cached absence still needs the insert
+    if (result == Result::ABSENT) {
+        return false;
+    }
+    success = false;
+    return true;
+}
+
+bool AuthHandler::Verify(const Credentials& credentials)
+{
+    auto start = Metrics::Clock::now();
+    auto success = Query(credentials);
+    Metrics::Observe(Histogram::DB, start);
+    return success;
+}
+
+bool AuthHandler::Query(const Credentials& credentials)
+{
+    auto mysqlConn = GetMysqlConnection();
+    if (mysqlConn == nullptr) {
+        return false;
+    }
+
+    auto username = credentials.username;
+    auto password = credentials.password;
+    auto usernameLength = static_cast<unsigned long>(username.size());
+    auto passwordLength = static_cast<unsigned long>(password.size());
+
+    MYSQL_BIND params[2]{};
+    params[0].buffer_type = MYSQL_TYPE_STRING;
+    params[0].buffer = const_cast<char*>(username.data());
+    params[0].buffer_length = usernameLength;
+    params[0].length = &usernameLength;
+    params[1].buffer_type = MYSQL_TYPE_STRING;
+    params[1].buffer = const_cast<char*>(password.data());
+    params[1].buffer_length = passwordLength;
+    params[1].length = &passwordLength;
+
+    auto cache = CredentialCache::Instance();
+    auto epoch = cache->Epoch(username);
+    auto select = mysqlConn->GetStatement(MysqlStatement::SELECT_AUTH);
+    if (select == nullptr || mysql_stmt_bind_param(select, params) || mysql_stmt_execute(select)) {
+        mysqlConn->Fail(select);
+        return false;
+    }
+
+    char realPassword[256] = {0};
+    unsigned long realPasswordLength = 0;
+    MYSQL_BIND result{};
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = realPassword;
+    result.buffer_length = sizeof(realPassword);
+    result.length = &realPasswordLength;
+    if (mysql_stmt_bind_result(select, &result) || mysql_stmt_store_result(select)) {
+        if (!mysqlConn->Fail(select)) {
+            mysql_stmt_free_result(select);
+        }
+        return false;
+    }
+    auto exist = mysql_stmt_fetch(select) == 0;
+    mysql_stmt_free_result(select);
+    mysqlConn->Touch();
+
+    if (exist) {
+        cache->Store(username, std::string_view(realPassword, realPasswordLength), epoch);
+    }
+    else {
+        cache->StoreAbsent(username, epoch);
+    }
+
+    if (credentials.isLogin) {
+        return exist && password == std::string_view(realPassword, realPasswordLength);
+    }
+
+    // register but user already exist
+    if (exist) {
+        return false;
+    }
+
+    auto insert = mysqlConn->GetStatement(MysqlStatement::INSERT_AUTH);
+    if (insert == nullptr || mysql_stmt_bind_param(insert, params) || mysql_stmt_execute(insert)) {
+        mysqlConn->Fail(insert);
+        return false;
+    }
+    cache->Invalidate(username);
+    return true;
+}
+
+}
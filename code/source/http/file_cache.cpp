@@ -0,0 +1,413 @@
+// Author: cute-giggle@outlook.com
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+
+#include "http/file_cache.h"
+#include "http/response_maker.h"
+
+namespace msv::http {
+
+CachedFile::~CachedFile()
+{
+    if (data != nullptr && encoded.empty()) {
+        munmap(const_cast<char*>(data), size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+FileCache::~FileCache()
+{
+    if (notifyFd_ >= 0) {
+        close(notifyFd_);
+    }
+}
+
+bool FileCache::Initialize(const Path& root, std::size_t capacity, std::size_t sendfileThreshold)
+{
+    capacity_ = capacity;
+    maxFileSize_ = capacity / 8;
+    sendfileThreshold_ = sendfileThreshold;
+
+    notifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notifyFd_ < 0) {
+        MLOG_WARNN("File cache inotify init failed, cached files will not be invalidated!");
+        return false;
+    }
+
+    std::error_code ec;
+    AddWatch(root);
+    for (auto iter = std::filesystem::recursive_directory_iterator(root, ec); !ec && iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec)) {
+        if (iter->is_directory(ec)) {
+            AddWatch(iter->path());
+        }
+    }
+    MLOG_INFOR("File cache initialize success! capacity: ", capacity_, " watches: ", watches_.size());
+    return true;
+}
+
+void FileCache::AddWatch(const Path& dir)
+{
+    static constexpr uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF;
+    auto wd = inotify_add_watch(notifyFd_, dir.c_str(), mask);
+    if (wd < 0) {
+        MLOG_WARNN("File cache add watch failed! path: ", dir.c_str());
+        return;
+    }
+    watches_[wd] = dir.lexically_normal();
+}
+
+CachedFilePtr FileCache::Find(const std::string& key)
+{
+    std::shared_lock locker(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end()) {
+        return nullptr;
+    }
+    iter->second.referenced.store(true, std::memory_order_relaxed);
+    return iter->second.file;
+}
+
+CachedFilePtr FileCache::Get(const Path& path)
+{
+    auto key = path.lexically_normal().string();
+    auto generation = generation_.load(std::memory_order_acquire);
+    if (auto file = Find(key); file != nullptr) {
+        return file;
+    }
+
+    auto file = Load(key);
+    if (file == nullptr) {
+        return nullptr;
+    }
+    if (Cost(*file) <= maxFileSize_) {
+        Insert(key, file, Cost(*file), generation);
+    }
+    return file;
+}
+
+CachedFilePtr FileCache::GetEncoded(const Path& path, const CachedFilePtr& file, ContentEncoding encoding)
+{
+    if (!file->compressible || encoding == ContentEncoding::IDENTITY) {
+        return file;
+    }
+    auto originKey = path.lexically_normal().string();
+    auto key = VariantKey(originKey, encoding);
+    auto generation = generation_.load(std::memory_order_acquire);
+    if (auto variant = Find(key); variant != nullptr) {
+        return variant;
+    }
+
+    CachedFilePtr variant{};
+    if (encoding == ContentEncoding::GZIP) {
+        variant = LoadSibling(path, *file);
+    }
+    if (variant == nullptr && file->size >= MIN_COMPRESS_SIZE && file->size <= maxFileSize_) {
+        variant = Compress(*file, encoding);
+    }
+    if (variant == nullptr) {
+        // remembered as the file itself so the next request does not try again, it costs nothing extra
+        InsertVariant(key, file, 0U, generation, originKey, file);
+        return file;
+    }
+    if (Cost(*variant) <= maxFileSize_) {
+        InsertVariant(key, variant, Cost(*variant), generation, originKey, file);
+    }
+    return variant;
+}
+
+std::shared_ptr<CachedFile> FileCache::Load(const Path& path) const
+{
+    auto file = LoadContent(path);
+    if (file == nullptr) {
+        return nullptr;
+    }
+    file->contentType = ResponseMaker::GetContentType(path);
+    file->cacheControl = ResponseMaker::GetCacheControl(path);
+    file->compressible = file->contentType.compare(0, 5, "text/") == 0 || file->contentType.find("xml") != std::string::npos;
+    MakeHeaders(*file);
+    return file;
+}
+
+std::shared_ptr<CachedFile> FileCache::LoadContent(const Path& path) const
+{
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+
+    auto file = std::make_shared<CachedFile>();
+    file->size = static_cast<std::size_t>(st.st_size);
+    if (file->size >= sendfileThreshold_) {
+        file->fd = fd;
+    }
+    else if (file->size > 0) {
+        auto ptr = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            MLOG_WARNN("File cache mmap file failed! path: ", path.c_str());
+            close(fd);
+            return nullptr;
+        }
+        file->data = reinterpret_cast<const char*>(ptr);
+    }
+    if (file->fd < 0) {
+        close(fd);
+    }
+
+    file->mtime = st.st_mtime;
+    file->lastModified = ResponseMaker::FormatHttpDate(st.st_mtime);
+    char etag[80]{};
+    auto mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", static_cast<unsigned long>(st.st_ino), static_cast<unsigned long>(mtime), static_cast<unsigned long>(st.st_size));
+    file->etag = etag;
+    return file;
+}
+
+CachedFilePtr FileCache::LoadSibling(const Path& path, const CachedFile& file) const
+{
+    // a sibling older than the file it was made from is stale
+    auto sibling = LoadContent(path.string() + ".gz");
+    if (sibling == nullptr || sibling->mtime < file.mtime) {
+        return nullptr;
+    }
+    sibling->mtime = file.mtime;
+    sibling->lastModified = file.lastModified;
+    // the sibling's own validator, its bytes may change without the file changing
+    sibling->etag = Tagged(sibling->etag, ContentEncoding::GZIP);
+    sibling->cacheControl = file.cacheControl;
+    sibling->contentType = file.contentType;
+    sibling->compressible = true;
+    sibling->encoding = ContentEncoding::GZIP;
+    MakeHeaders(*sibling);
+    return sibling;
+}
+
+CachedFilePtr FileCache::Compress(const CachedFile& file, ContentEncoding encoding) const
+{
+    std::string content{};
+    auto source = file.data;
+    if (source == nullptr) {
+        content.resize(file.size);
+        if (pread(file.fd, content.data(), file.size, 0) != static_cast<ssize_t>(file.size)) {
+            MLOG_WARNN("File cache read file failed! fd: ", file.fd);
+            return nullptr;
+        }
+        source = content.data();
+    }
+
+    // window bits 15 gives the zlib format "deflate" stands for, +16 wraps it as gzip instead
+    z_stream stream{};
+    auto windowBits = encoding == ContentEncoding::GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&stream, COMPRESS_LEVEL, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        MLOG_WARNN("File cache deflate init failed!");
+        return nullptr;
+    }
+    auto variant = std::make_shared<CachedFile>();
+    variant->encoded.resize(deflateBound(&stream, file.size));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(source));
+    stream.avail_in = static_cast<uInt>(file.size);
+    stream.next_out = reinterpret_cast<Bytef*>(variant->encoded.data());
+    stream.avail_out = static_cast<uInt>(variant->encoded.size());
+    auto ret = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    // not worth it unless at least an eighth is saved
+    if (ret != Z_STREAM_END || stream.total_out > file.size - file.size / 8) {
+        return nullptr;
+    }
+    variant->encoded.resize(stream.total_out);
+    variant->encoded.shrink_to_fit();
+
+    variant->data = variant->encoded.data();
+    variant->size = variant->encoded.size();
+    variant->mtime = file.mtime;
+    variant->lastModified = file.lastModified;
+    variant->etag = Tagged(file.etag, encoding);
+    variant->cacheControl = file.cacheControl;
+    variant->contentType = file.contentType;
+    variant->compressible = true;
+    variant->encoding = encoding;
+    MakeHeaders(*variant);
+    return variant;
+}
+
+std::string FileCache::Tagged(const std::string& etag, ContentEncoding encoding)
+{
+    // "abc" -> "abc-gzip"
+    return etag.substr(0, etag.size() - 1) + "-" + CODINGS[static_cast<std::size_t>(encoding)] + "\"";
+}
+
+void FileCache::MakeHeaders(CachedFile& file)
+{
+    // validators and caching policy, a 304 repeats them
+    std::string validators = "ETag: " + file.etag + "\r\nLast-Modified: " + file.lastModified + "\r\nCache-Control: " + file.cacheControl + "\r\n";
+    if (file.compressible) {
+        validators += "Vary: Accept-Encoding\r\n";
+    }
+
+    // byte ranges are only served on the identity representation
+    std::string extra{};
+    if (file.encoding == ContentEncoding::IDENTITY) {
+        extra += "Accept-Ranges: bytes\r\n";
+    }
+    else {
+        extra += "Content-Encoding: " + std::string(CODINGS[static_cast<std::size_t>(file.encoding)]) + "\r\n";
+    }
+    extra += validators;
+    file.header[0] = ResponseMaker::MakeHeader(200, false, file.contentType, file.size, extra);
+    file.header[1] = ResponseMaker::MakeHeader(200, true, file.contentType, file.size, extra);
+    // no body follows a 304, the length is that of the representation it stands for
+    file.notModified[0] = ResponseMaker::MakeHeader(304, false, file.contentType, file.size, validators);
+    file.notModified[1] = ResponseMaker::MakeHeader(304, true, file.contentType, file.size, validators);
+}
+
+void FileCache::Insert(const std::string& key, const CachedFilePtr& file, std::size_t cost, uint64_t generation)
+{
+    std::unique_lock locker(mutex_);
+    if (generation != generation_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Publish(key, file, cost);
+}
+
+void FileCache::InsertVariant(const std::string& key, const CachedFilePtr& variant, std::size_t cost, uint64_t generation, const std::string& originKey, const CachedFilePtr& origin)
+{
+    std::unique_lock locker(mutex_);
+    if (generation != generation_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // made from a file that has since been invalidated or replaced
+    auto iter = entries_.find(originKey);
+    if (iter == entries_.end() || iter->second.file != origin) {
+        return;
+    }
+    Publish(key, variant, cost);
+}
+
+void FileCache::Publish(const std::string& key, const CachedFilePtr& file, std::size_t cost)
+{
+    // called with the lock held
+    auto [iter, inserted] = entries_.try_emplace(key);
+    if (!inserted) {
+        // raced with another loader, keep the one already published
+        return;
+    }
+    iter->second.file = file;
+    iter->second.cost = cost;
+    // a new entry gets a full turn of the hand before it can go
+    iter->second.referenced.store(true, std::memory_order_relaxed);
+    size_ += cost;
+    Evict();
+}
+
+void FileCache::Evict()
+{
+    auto iter = entries_.find(hand_);
+    if (iter == entries_.end()) {
+        iter = entries_.begin();
+    }
+    // two turns at most: the first clears reference bits, the second finds them still clear
+    for (auto steps = 2 * entries_.size(); steps > 0 && size_ > capacity_; --steps) {
+        if (iter == entries_.end()) {
+            iter = entries_.begin();
+        }
+        if (iter->second.referenced.exchange(false, std::memory_order_relaxed)) {
+            ++iter;
+            continue;
+        }
+        size_ -= iter->second.cost;
+        iter = entries_.erase(iter);
+    }
+    hand_ = iter != entries_.end() ? iter->first : std::string();
+}
+
+void FileCache::HandleNotify()
+{
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+        auto len = read(notifyFd_, buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
+
+        std::unique_lock locker(mutex_);
+        generation_.fetch_add(1, std::memory_order_release);
+        for (auto ptr = buffer; ptr < buffer + len;) {
+            auto event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                entries_.clear();
+                size_ = 0;
+                continue;
+            }
+            auto watch = watches_.find(event->wd);
+            if (watch == watches_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(watch);
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+
+            auto path = watch->second / event->name;
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                AddWatch(path);
+                continue;
+            }
+            Invalidate(path.string(), event->mask & IN_ISDIR);
+        }
+    }
+}
+
+void FileCache::Erase(const std::string& key)
+{
+    auto iter = entries_.find(key);
+    if (iter != entries_.end()) {
+        MLOG_DEBUG("File cache invalidate: ", key);
+        size_ -= iter->second.cost;
+        entries_.erase(iter);
+    }
+}
+
+void FileCache::Invalidate(const std::string& key, bool isDirectory)
+{
+    if (!isDirectory) {
+        Erase(key);
+        Erase(VariantKey(key, ContentEncoding::GZIP));
+        Erase(VariantKey(key, ContentEncoding::DEFLATE));
+        // a changed ".gz" sibling takes the gzip variant of its file with it
+        static constexpr std::string_view suffix = ".gz";
+        if (key.size() > suffix.size() && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            Erase(VariantKey(key.substr(0, key.size() - suffix.size()), ContentEncoding::GZIP));
+        }
+        return;
+    }
+
+    // a directory went away or was renamed, drop everything below it
+    auto prefix = key + "/";
+    for (auto iter = entries_.begin(); iter != entries_.end();) {
+        if (iter->first.compare(0, prefix.size(), prefix) == 0) {
+            size_ -= iter->second.cost;
+            iter = entries_.erase(iter);
+            continue;
+        }
+        ++iter;
+    }
+}
+
+}
@@ -14,68 +14,239 @@ void HttpConnection::Initialize(TriggerMode triggerMode, int cfd, struct sockadd
     caddr_ = caddr;
     closed_ = false;
     keepAlive_ = false;
-    responseData_ = {};
-    bzero(writeBuffer_, sizeof(struct iovec) * 2);
+    writeInterest_ = false;
+    readLimited_ = false;
+    ResetResponses();
     readBuffer_.Clear();
     requestParser_.Reset();
+    exchange_.Reset();
 
     NumOnline += 1;
 }
 
+void HttpConnection::ResetResponses()
+{
+    ClearBatch();
+    producer_.reset();
+    chunked_ = false;
+}
+
+void HttpConnection::ClearBatch()
+{
+    responses_.clear();
+    iovecs_.clear();
+    files_.clear();
+    iovPos_ = 0;
+    filePos_ = 0;
+}
+
 bool HttpConnection::Process()
 {
-    MLOG_DEBUG("Current request:\n", readBuffer_.String());
+    MLOG_DEBUG("Current request:\n", readBuffer_.View());
 
-    auto parseRet = requestParser_.Parse(readBuffer_);
-    using RetStatus = RequestParser::RetStatus;
-    if (parseRet == RetStatus::NO_REQUEST) {
+    ResetResponses();
+    // nothing is answered after a response that closes the connection
+    while (responses_.size() < MAX_PIPELINE_DEPTH && ProcessOne() && keepAlive_ && producer_ == nullptr) {}
+    if (responses_.empty()) {
         return false;
     }
-    if (parseRet == RetStatus::BAD_REQUEST) {
-        auto resPath = std::filesystem::path(ResDir).append("400.html");
-        responseData_ = responseMaker_.Make(resPath, 400, false);
+    writeStart_ = Metrics::Clock::now();
+    return true;
+}
+
+bool HttpConnection::ProcessOne()
+{
+    using RetStatus = RequestParser::RetStatus;
+
+    auto processStart = Metrics::Clock::now();
+    if (exchange_.IsDeferred()) {
+        // answered once its result is in, before anything pipelined behind it
+        if (!exchange_.Resume()) {
+            return false;
+        }
     }
     else {
-        auto resPath = ResDir.string() + requestParser_.GetPath();
-        responseData_ = responseMaker_.Make(resPath, 200, requestParser_.IsKeepAlive());
-    }
+        auto parseRet = requestParser_.Parse(readBuffer_);
+        if (parseRet == RetStatus::NO_REQUEST) {
+            return false;
+        }
+        auto parseEnd = Metrics::Clock::now();
+        Metrics::Observe(Histogram::PARSE, parseEnd - processStart);
+        Metrics::Add(Counter::REQUESTS);
+        processStart = parseEnd;
 
-    MLOG_DEBUG("Response header:\n", responseData_.header);
+        exchange_.Begin();
+        if (parseRet == RetStatus::BAD_REQUEST) {
+            Metrics::Add(Counter::PARSE_ERRORS);
+            exchange_.RespondError(400);
+        }
+        else if (parseRet == RetStatus::TOO_LARGE) {
+            exchange_.RespondError(413);
+        }
+        else {
+            Router::Instance()->Dispatch(exchange_);
+        }
+        if (exchange_.IsDeferred()) {
+            return false;
+        }
+    }
+    auto response = exchange_.TakeResponse();
+    keepAlive_ = exchange_.IsKeepAlive();
 
-    writeBuffer_[0].iov_base = const_cast<char *>(responseData_.header.c_str());
-    writeBuffer_[0].iov_len = responseData_.header.length();
-    if (responseData_.body != nullptr) {
-        writeBuffer_[1].iov_base = const_cast<char *>(responseData_.body);
-        writeBuffer_[1].iov_len = responseData_.bodyLength;
+    // the status class sits right after "HTTP/1.1 "
+    auto statusClass = response.header.size() > 9 ? response.header[9] : '0';
+    if (statusClass == '4') {
+        Metrics::Add(Counter::RESPONSES_4XX);
     }
-    keepAlive_ = requestParser_.IsKeepAlive();
+    else if (statusClass == '5') {
+        Metrics::Add(Counter::RESPONSES_5XX);
+    }
+    Metrics::Observe(Histogram::PROCESS, processStart);
+
+    MLOG_DEBUG("Response header:\n", response.header);
+
+    Enqueue(std::move(response));
     requestParser_.Reset();
     return true;
 }
 
+void HttpConnection::Enqueue(ResponseData&& response)
+{
+    auto append = [this](const char* data, std::size_t length) {
+        if (length != 0) {
+            iovecs_.push_back({const_cast<char *>(data), length});
+        }
+    };
+    auto appendFile = [this](int fd, off_t offset, std::size_t length) {
+        if (length != 0) {
+            files_.push_back({iovecs_.size(), fd, offset, length});
+        }
+    };
+    append(response.header.data(), response.header.length());
+    if (response.body != nullptr) {
+        append(response.body, response.bodyLength);
+    }
+    if (response.fileFd >= 0) {
+        appendFile(response.fileFd, response.fileOffset, response.fileLength);
+    }
+    for (const auto& segment : response.chain) {
+        if (segment.fd >= 0) {
+            appendFile(segment.fd, segment.offset, segment.length);
+        }
+        else {
+            append(segment.data, segment.length);
+        }
+    }
+    if (response.producer != nullptr) {
+        producer_ = response.producer;
+        chunked_ = response.chunked;
+    }
+    // header and body point into storage the response shares, moving it keeps them valid
+    responses_.push_back(std::move(response));
+}
+
 bool HttpConnection::Write()
 {
-    auto iovCnt = writeBuffer_[1].iov_base ? 2 : 1;
+    // progress lives in iovPos_ and the file parts, so a write interrupted by EAGAIN resumes where it stopped
     while (!WriteComplete()) {
-        auto len = writev(cfd_, writeBuffer_, iovCnt);
-        if (len < 0) {
-            return errno == EAGAIN;
+        if (BatchWritten()) {
+            if (!Produce()) {
+                return false;
+            }
+            continue;
         }
-        if (len == 0) {
-            return false;
+        auto boundary = filePos_ < files_.size() ? files_[filePos_].iovIndex : iovecs_.size();
+        auto ret = iovPos_ < boundary ? WriteMemory(boundary) : WriteFile();
+        if (!ret) {
+            return errno == EAGAIN;
         }
+    }
+    // from the batch being ready until its last byte left, waiting on the socket included
+    Metrics::Observe(Histogram::WRITE, writeStart_);
+    ResetResponses();
+    return true;
+}
+
+bool HttpConnection::Produce()
+{
+    static constexpr std::string_view crlf = "\r\n";
+    static constexpr std::string_view lastChunk = "0\r\n\r\n";
 
-        if (len >= writeBuffer_[0].iov_len) {
-            writeBuffer_[1].iov_base = reinterpret_cast<uint8_t *>(writeBuffer_[1].iov_base) + len - writeBuffer_[0].iov_len;
-            writeBuffer_[1].iov_len -= len - writeBuffer_[0].iov_len;
-            writeBuffer_[0].iov_base = nullptr;
-            writeBuffer_[0].iov_len = 0;
+    // the socket took everything so far, the responses of the batch are no longer needed
+    ClearBatch();
+    produced_.clear();
+    auto done = false;
+    if (!producer_->Produce(produced_, STREAM_CHUNK_SIZE, done) || (produced_.empty() && !done)) {
+        MLOG_ERROR("Body producer failed!");
+        errno = EIO;
+        return false;
+    }
+
+    auto append = [this](const char* data, std::size_t length) {
+        if (length != 0) {
+            iovecs_.push_back({const_cast<char *>(data), length});
         }
-        else {
-            writeBuffer_[0].iov_base = reinterpret_cast<uint8_t *>(writeBuffer_[0].iov_base) + len;
-            writeBuffer_[0].iov_len -= len;
+    };
+    if (chunked_ && !produced_.empty()) {
+        auto length = snprintf(chunkSize_, sizeof(chunkSize_), "%zx\r\n", produced_.size());
+        append(chunkSize_, length);
+    }
+    append(produced_.data(), produced_.size());
+    if (chunked_ && !produced_.empty()) {
+        append(crlf.data(), crlf.size());
+    }
+    if (chunked_ && done) {
+        append(lastChunk.data(), lastChunk.size());
+    }
+    if (done) {
+        producer_.reset();
+    }
+    return true;
+}
+
+bool HttpConnection::WriteFile()
+{
+    auto& file = files_[filePos_];
+    auto len = sendfile(cfd_, file.fd, &file.offset, file.remain);
+    if (len <= 0) {
+        errno = len == 0 ? EPIPE : errno;
+        return false;
+    }
+    file.remain -= len;
+    if (file.remain == 0) {
+        ++filePos_;
+    }
+    Metrics::Add(Counter::BYTES_OUT, len);
+    return true;
+}
+
+bool HttpConnection::WriteMemory(std::size_t boundary)
+{
+    auto count = std::min<std::size_t>(boundary - iovPos_, IOV_MAX);
+    struct msghdr msg{};
+    msg.msg_iov = iovecs_.data() + iovPos_;
+    msg.msg_iovlen = count;
+    // hold back while more of the batch follows, so small responses leave in full segments
+    auto more = iovPos_ + count < iovecs_.size() || filePos_ < files_.size() || producer_ != nullptr;
+    auto len = sendmsg(cfd_, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    if (len <= 0) {
+        errno = len == 0 ? EPIPE : errno;
+        return false;
+    }
+    Metrics::Add(Counter::BYTES_OUT, len);
+
+    std::size_t remain = len;
+    while (remain != 0) {
+        auto& iov = iovecs_[iovPos_];
+        if (remain < iov.iov_len) {
+            iov.iov_base = reinterpret_cast<uint8_t *>(iov.iov_base) + remain;
+            iov.iov_len -= remain;
+            break;
         }
+        remain -= iov.iov_len;
+        ++iovPos_;
     }
     return true;
 }
-}
\ No newline at end of file
+
+}
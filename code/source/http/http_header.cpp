@@ -0,0 +1,297 @@
+// Author: cute-giggle@outlook.com
+
+#include <strings.h>
+#include <charconv>
+
+#include "http/http_header.h"
+
+namespace msv::http {
+
+Method ParseMethod(std::string_view method)
+{
+    // methods are case-sensitive
+    if (method == "GET") {
+        return Method::GET;
+    }
+    if (method == "POST") {
+        return Method::POST;
+    }
+    return Method::UNKNOWN;
+}
+
+std::string_view MethodName(Method method)
+{
+    static constexpr std::string_view names[] = {"GET", "POST"};
+    return method < Method::COUNT ? names[static_cast<std::size_t>(method)] : std::string_view();
+}
+
+bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs)
+{
+    return lhs.size() == rhs.size() && strncasecmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+std::string_view TrimWhitespace(std::string_view str)
+{
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+namespace {
+
+bool ToInteger(std::string_view str, int64_t& value)
+{
+    auto end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, value);
+    return !str.empty() && ec == std::errc() && ptr == end && value >= 0;
+}
+
+}
+
+bool ParseContentLength(std::string_view value, std::size_t& length)
+{
+    int64_t number = 0;
+    if (!ToInteger(TrimWhitespace(value), number)) {
+        return false;
+    }
+    length = static_cast<std::size_t>(number);
+    return true;
+}
+
+bool ParseChunkSize(std::string_view line, std::size_t& size)
+{
+    auto digits = TrimWhitespace(line.substr(0, line.find(';')));
+    auto end = digits.data() + digits.size();
+    auto [ptr, ec] = std::from_chars(digits.data(), end, size, 16);
+    return !digits.empty() && ec == std::errc() && ptr == end;
+}
+
+namespace {
+
+int HexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+}
+
+bool DecodeFormComponent(char* data, std::size_t& length)
+{
+    std::size_t out = 0;
+    for (std::size_t in = 0; in < length; ++in) {
+        auto c = data[in];
+        if (c == '+') {
+            c = ' ';
+        }
+        else if (c == '%') {
+            auto high = in + 2 < length ? HexValue(data[in + 1]) : -1;
+            auto low = high >= 0 ? HexValue(data[in + 2]) : -1;
+            if (low < 0) {
+                return false;
+            }
+            c = static_cast<char>(high * 16 + low);
+            in += 2;
+        }
+        data[out++] = c;
+    }
+    length = out;
+    return true;
+}
+
+bool ParseByteRanges(std::string_view value, std::vector<ByteRange>& ranges)
+{
+    static constexpr std::string_view unit = "bytes=";
+
+    ranges.clear();
+    value = TrimWhitespace(value);
+    if (!EqualsIgnoreCase(value.substr(0, unit.size()), unit)) {
+        return false;
+    }
+    value.remove_prefix(unit.size());
+
+    while (!value.empty()) {
+        auto comma = value.find(',');
+        auto spec = TrimWhitespace(value.substr(0, comma));
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        if (spec.empty()) {
+            continue;
+        }
+
+        auto dash = spec.find('-');
+        if (dash == std::string_view::npos) {
+            return false;
+        }
+        auto first = spec.substr(0, dash);
+        auto last = spec.substr(dash + 1);
+        ByteRange range{-1, -1};
+        if (first.empty()) {
+            if (!ToInteger(last, range.last)) {
+                return false;
+            }
+        }
+        else {
+            if (!ToInteger(first, range.first)) {
+                return false;
+            }
+            if (!last.empty() && (!ToInteger(last, range.last) || range.last < range.first)) {
+                return false;
+            }
+        }
+        ranges.push_back(range);
+    }
+    return !ranges.empty();
+}
+
+bool ParseHttpDate(std::string_view value, time_t& time)
+{
+    char buffer[64]{};
+    value = TrimWhitespace(value);
+    if (value.empty() || value.size() >= sizeof(buffer)) {
+        return false;
+    }
+    value.copy(buffer, value.size());
+
+    struct tm tm{};
+    auto end = strptime(buffer, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0') {
+        return false;
+    }
+    time = timegm(&tm);
+    return time != -1;
+}
+
+bool MatchEntityTag(std::string_view list, std::string_view etag)
+{
+    auto opaque = [](std::string_view tag) {
+        return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+    };
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto tag = TrimWhitespace(list.substr(0, comma));
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        if (tag == "*" || (!tag.empty() && opaque(tag) == opaque(etag))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t ParseAcceptEncoding(std::string_view value)
+{
+    uint8_t accepted = EncodingBit(ContentEncoding::IDENTITY);
+    uint8_t rejected = 0U;
+    uint8_t wildcard = 0U;
+    while (!value.empty()) {
+        auto comma = value.find(',');
+        auto item = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        auto semicolon = item.find(';');
+        auto coding = TrimWhitespace(item.substr(0, semicolon));
+        // "q=0", "q=0.0" and so on
+        auto zero = false;
+        if (semicolon != std::string_view::npos) {
+            auto param = TrimWhitespace(item.substr(semicolon + 1));
+            if (param.size() >= 3 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=' && param[2] == '0') {
+                param.remove_prefix(3);
+                zero = param.empty() || (param[0] == '.' && param.find_first_not_of('0', 1) == std::string_view::npos);
+            }
+        }
+
+        uint8_t bit = 0U;
+        if (EqualsIgnoreCase(coding, "gzip") || EqualsIgnoreCase(coding, "x-gzip")) {
+            bit = EncodingBit(ContentEncoding::GZIP);
+        }
+        else if (EqualsIgnoreCase(coding, "deflate")) {
+            bit = EncodingBit(ContentEncoding::DEFLATE);
+        }
+        else if (coding == "*") {
+            wildcard = zero ? 0U : EncodingBit(ContentEncoding::GZIP) | EncodingBit(ContentEncoding::DEFLATE);
+            continue;
+        }
+        if (zero) {
+            rejected |= bit;
+        }
+        else {
+            accepted |= bit;
+        }
+    }
+    // "*" covers the codings not listed explicitly
+    return (accepted | (wildcard & ~rejected)) & ~rejected;
+}
+
+HeaderField HeaderTable::Lookup(std::string_view name)
+{
+    static constexpr std::array<std::string_view, static_cast<std::size_t>(HeaderField::COUNT)> names = {
+        "Connection",
+        "Content-Length",
+        "Content-Type",
+        "Host",
+        "User-Agent",
+        "Accept",
+        "Accept-Encoding",
+        "Transfer-Encoding",
+        "Range",
+        "If-Range",
+        "If-None-Match",
+        "If-Modified-Since",
+    };
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (EqualsIgnoreCase(names[i], name)) {
+            return static_cast<HeaderField>(i);
+        }
+    }
+    return HeaderField::UNKNOWN;
+}
+
+void HeaderTable::Set(std::string_view name, std::string_view value)
+{
+    auto field = Lookup(name);
+    if (field != HeaderField::UNKNOWN) {
+        known_[Index(field)].assign(value);
+        present_ |= Bit(field);
+        return;
+    }
+
+    for (std::size_t i = 0; i < numOthers_; ++i) {
+        if (EqualsIgnoreCase(others_[i].first, name)) {
+            others_[i].second.assign(value);
+            return;
+        }
+    }
+    if (numOthers_ == others_.size()) {
+        others_.emplace_back();
+    }
+    others_[numOthers_].first.assign(name);
+    others_[numOthers_].second.assign(value);
+    numOthers_ += 1;
+}
+
+std::string_view HeaderTable::Get(std::string_view name) const
+{
+    auto field = Lookup(name);
+    if (field != HeaderField::UNKNOWN) {
+        return Get(field);
+    }
+    for (std::size_t i = 0; i < numOthers_; ++i) {
+        if (EqualsIgnoreCase(others_[i].first, name)) {
+            return others_[i].second;
+        }
+    }
+    return {};
+}
+
+}
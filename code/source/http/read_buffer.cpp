@@ -1,34 +1,86 @@
 // Author: cute-giggle@outlook.com
 
 #include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
 
 #include "http/read_buffer.h"
 
 namespace msv::http {
 
+ssize_t ReadBuffer::ReadOnce(int fd)
+{
+    MakeSpace(MAX_ONCE_READ_SIZE);
+
+    // read straight into the buffer tail, spill into the stack only when the tail is not enough
+    char extra[EXTRA_READ_SIZE];
+    struct iovec iov[2];
+    iov[0].iov_base = data_.data() + writePos_;
+    iov[0].iov_len = Writable();
+    iov[1].iov_base = extra;
+    iov[1].iov_len = sizeof(extra);
+
+    auto len = readv(fd, iov, 2);
+    if (len <= 0) {
+        return len;
+    }
+
+    auto size = static_cast<std::size_t>(len);
+    if (size <= iov[0].iov_len) {
+        writePos_ += size;
+        return len;
+    }
+
+    writePos_ = data_.size();
+    size -= iov[0].iov_len;
+    MakeSpace(size);
+    std::memcpy(data_.data() + writePos_, extra, size);
+    writePos_ += size;
+    return len;
+}
+
+void ReadBuffer::Append(std::string_view data)
+{
+    MakeSpace(data.size());
+    std::memcpy(data_.data() + writePos_, data.data(), data.size());
+    writePos_ += data.size();
+}
+
+void ReadBuffer::MakeSpace(std::size_t n)
+{
+    if (Writable() >= n) {
+        return;
+    }
+    // compact only when the consumed prefix gives back enough room
+    if (readPos_ + Writable() >= n) {
+        auto size = Size();
+        std::memmove(data_.data(), data_.data() + readPos_, size);
+        readPos_ = 0;
+        writePos_ = size;
+        return;
+    }
+    data_.resize(writePos_ + n);
+}
+
 bool ReadBuffer::ReadLT(int fd)
 {
     if (fd < 0) {
         return false;
     }
 
-    char buffer[MAX_ONCE_READ_SIZE] = {0};
-    auto len = read(fd, buffer, sizeof(buffer));
+    auto len = ReadOnce(fd);
 
     // read ready but no reads
     if (len <= 0) {
         return false;
     }
-
-    std::copy(buffer, buffer + len, std::back_inserter(data_));
     return true;
 }
 
-bool ReadBuffer::ReadET(int fd)
+bool ReadBuffer::ReadET(int fd, std::size_t limit)
 {
-    while (true) {
-        char buffer[MAX_ONCE_READ_SIZE] = {0};
-        auto len = read(fd, buffer, sizeof(buffer));
+    while (Size() < limit) {
+        auto len = ReadOnce(fd);
 
         if (len == -1) {
             // read complete
@@ -42,31 +94,38 @@ bool ReadBuffer::ReadET(int fd)
         if (len == 0) {
             return false;
         }
-
-        std::copy(buffer, buffer + len, std::back_inserter(data_));
     }
     return true;
 }
 
-std::optional<std::string> ReadBuffer::GetLine()
+std::optional<std::string_view> ReadBuffer::GetLine()
 {
-    static const char *CRLF = "\r\n";
-    auto iter = std::search(data_.begin(), data_.end(), CRLF, CRLF + 2);
-    if (iter == data_.end()) {
-        return std::nullopt;
+    auto view = View();
+    while (scanPos_ < view.size()) {
+        // memchr is vectorized by libc, far cheaper than a byte loop or std::search
+        auto lf = static_cast<const char*>(std::memchr(view.data() + scanPos_, '\n', view.size() - scanPos_));
+        if (lf == nullptr) {
+            break;
+        }
+        auto pos = static_cast<std::size_t>(lf - view.data());
+        if (pos > 0 && view[pos - 1] == '\r') {
+            readPos_ += pos + 1;
+            scanPos_ = 0;
+            return view.substr(0, pos - 1);
+        }
+        scanPos_ = pos + 1;
     }
-    std::string line(data_.begin(), iter);
-    data_.erase(data_.begin(), iter + 2);
-    return std::make_optional(line);
+    scanPos_ = view.size();
+    return std::nullopt;
 }
 
-std::optional<std::string> ReadBuffer::GetBytes(std::size_t n)
+std::optional<std::string_view> ReadBuffer::GetBytes(std::size_t n)
 {
-    n = std::min(Size(), n);
-    std::string data(data_.begin(), data_.begin() + n);
-    data_.erase(data_.begin(), data_.begin() + n);
-    return std::make_optional(data);
+    auto view = View().substr(0, n);
+    readPos_ += view.size();
+    scanPos_ = 0;
+    return view;
 }
 
 
-}
\ No newline at end of file
+}
@@ -1,20 +1,45 @@
 // Author: cute-giggle@outlook.com
 
+#include <cstring>
+
 #include "http/request_parser.h"
+#include "http/router.h"
 
 namespace msv::http {
 
-bool RequestParser::ParseRequestLine(const std::string &line)
+std::size_t RequestParser::MaxBodySize = RequestParser::DEFAULT_MAX_BODY_SIZE;
+
+namespace {
+
+// split off the token before the first space, fails on empty tokens
+bool NextToken(std::string_view& line, std::string_view& token)
+{
+    auto pos = line.find(' ');
+    if (pos == 0 || pos == std::string_view::npos) {
+        return false;
+    }
+    token = line.substr(0, pos);
+    line.remove_prefix(pos + 1);
+    return true;
+}
+
+}
+
+bool RequestParser::ParseRequestLine(std::string_view line)
 {
-    std::regex expr("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch result;
-    if (std::regex_match(line, result, expr)) {
-        method_ = std::move(result[1]);
-        path_ = std::move(result[2]);
-        version_ = std::move(result[3]);
-        return method_ == "GET" || method_ == "POST";
-    }
-    return false;
+    static constexpr std::string_view prefix = "HTTP/";
+
+    std::string_view method, path;
+    if (!NextToken(line, method) || !NextToken(line, path)) {
+        return false;
+    }
+    if (line.substr(0, prefix.size()) != prefix || line.size() == prefix.size() || line.find(' ') != std::string_view::npos) {
+        return false;
+    }
+    method_.assign(method);
+    path_.assign(path);
+    version_.assign(line.substr(prefix.size()));
+    return method_ == "GET" || method_ == "POST";
 }
 
 void RequestParser::Reset()
@@ -23,157 +48,182 @@ void RequestParser::Reset()
     method_.clear();
     path_.clear();
     version_.clear();
-    header_.clear();
+    header_.Clear();
+    ranges_.clear();
     body_.clear();
+    remaining_ = 0;
+    bodyRefused_ = false;
+    form_.clear();
 }
 
-void RequestParser::FormatPath()
+const std::vector<ByteRange>* RequestParser::ParseRange()
 {
-    static const std::set<std::string> urls = {"/index", "/register", "/login", "/home", "/image", "/video"};
-
-    if (*(path_.rbegin()) == '/') {
-        path_.pop_back();
+    // an unparsable Range header is ignored, too many ranges are ignored as well
+    if (method_ != "GET" || !header_.Has(HeaderField::RANGE)) {
+        return nullptr;
     }
-
-    if (path_.empty()) {
-        path_ = "/index.html";
-    } else if (urls.count(path_)) {
-        path_ += ".html";
+    if (!ParseByteRanges(header_.Get(HeaderField::RANGE), ranges_) || ranges_.size() > MAX_RANGE_COUNT) {
+        return nullptr;
     }
+    return &ranges_;
 }
 
-bool RequestParser::ParseHeader(const std::string &line)
+Preconditions RequestParser::ParseConditions() const
 {
-    std::regex expr("^([^:]*): ?(.*)$");
-    std::smatch result;
-    if (std::regex_match(line, result, expr)) {
-        header_[result[1]] = result[2];
-        return true;
+    Preconditions conditions{};
+    if (method_ != "GET") {
+        return conditions;
+    }
+    if (header_.Has(HeaderField::IF_NONE_MATCH)) {
+        conditions.ifNoneMatch = header_.Get(HeaderField::IF_NONE_MATCH);
+        return conditions;
+    }
+    if (header_.Has(HeaderField::IF_MODIFIED_SINCE) && !ParseHttpDate(header_.Get(HeaderField::IF_MODIFIED_SINCE), conditions.ifModifiedSince)) {
+        conditions.ifModifiedSince = -1;
     }
-    return false;
+    return conditions;
 }
 
-bool RequestParser::ParseBody(const std::string &line)
+bool RequestParser::ParseHeader(std::string_view line)
 {
-    if (path_ != "/login.html" && path_ != "/register.html") {
+    auto colon = line.find(':');
+    if (colon == 0 || colon == std::string_view::npos) {
         return false;
     }
-    if (method_ != "POST" || header_["Content-Type"] != "application/x-www-form-urlencoded") {
+    auto name = line.substr(0, colon);
+    if (name.find_first_of(" \t") != std::string_view::npos) {
         return false;
     }
-
-    auto str = line;
-    std::replace(str.begin(), str.end(), '&', ' ');
-    std::replace(str.begin(), str.end(), '=', ' ');
-    std::stringstream ss(str);
-    while (!ss.eof()) {
-        std::string key, value;
-        ss >> key >> value;
-        std::replace(key.begin(), key.end(), '+', ' ');
-        std::replace(value.begin(), value.end(), '+', ' ');
-        body_[key] = value;
-    }
-
-    if (!body_.count("username") || !body_.count("password")) {
-        return false;
-    }
-
+    header_.Set(name, TrimWhitespace(line.substr(colon + 1)));
     return true;
 }
 
-void RequestParser::UserVerify()
+RequestParser::RetStatus RequestParser::StartBody()
 {
-    bool tryLogin = (path_ == "/login.html");
-    auto mysqlConn = GetMysqlConnection();
-
-    const auto &username = body_["username"];
-    const auto &password = body_["password"];
-
-    char order[256] = {0};
-    snprintf(order, sizeof(order), "SELECT username, password FROM tb_auth WHERE username='%s' LIMIT 1", username.c_str());
-
-    if (mysql_query(mysqlConn.get(), order)) {
-        path_ = "/error.html";
-        return;
+    // a body nothing will take is left unread, the 404 or 405 is answered on the headers alone
+    if (!Router::Instance()->Takes(GetMethod(), path_)) {
+        bodyRefused_ = true;
+        parseStatus_ = ParseStatus::FINISH;
+        return RetStatus::NO_REQUEST;
+    }
+    if (header_.Has(HeaderField::TRANSFER_ENCODING)) {
+        // a length next to chunked framing is how requests get smuggled
+        if (header_.Has(HeaderField::CONTENT_LENGTH) || !EqualsIgnoreCase(header_.Get(HeaderField::TRANSFER_ENCODING), "chunked")) {
+            return RetStatus::BAD_REQUEST;
+        }
+        parseStatus_ = ParseStatus::CHUNK_SIZE;
+        return RetStatus::NO_REQUEST;
     }
 
-    auto result = mysql_store_result(mysqlConn.get());
-    auto numRows = mysql_num_rows(result);
-
-    // login but user not exist
-    if (tryLogin && numRows == 0) {
-        path_ = "/error.html";
-        mysql_free_result(result);
-        return;
+    std::size_t length = 0;
+    if (!ParseContentLength(header_.Get(HeaderField::CONTENT_LENGTH), length)) {
+        return RetStatus::BAD_REQUEST;
     }
+    if (length > MaxBodySize) {
+        return RetStatus::TOO_LARGE;
+    }
+    remaining_ = length;
+    parseStatus_ = ParseStatus::BODY;
+    return RetStatus::NO_REQUEST;
+}
 
-    if (tryLogin) {
-        auto row = mysql_fetch_row(result);
-        std::string realPassword = row[1];
-        if (password == realPassword) {
-            path_ = "/home.html";
-            mysql_free_result(result);
-            return;
+bool RequestParser::DecodeForm()
+{
+    // pairs are decoded where they lie, a decoded component never outgrows its encoding
+    form_.clear();
+    auto data = body_.data();
+    auto end = body_.data() + body_.size();
+    while (data < end) {
+        auto amp = static_cast<char*>(std::memchr(data, '&', end - data));
+        auto pairEnd = amp != nullptr ? amp : end;
+        if (pairEnd == data) {
+            data = pairEnd + 1;
+            continue;
+        }
+        // a bare name is not an empty value
+        auto equal = static_cast<char*>(std::memchr(data, '=', pairEnd - data));
+        if (equal == nullptr) {
+            return false;
         }
-        path_ = "/error.html";
-        mysql_free_result(result);
-        return;
-    }
 
-    // register but user already exist
-    if (numRows) {
-        path_ = "/error.html";
-        mysql_free_result(result);
-        return;
+        std::size_t keyLength = equal - data;
+        std::size_t valueLength = pairEnd - equal - 1;
+        if (!DecodeFormComponent(data, keyLength) || !DecodeFormComponent(equal + 1, valueLength)) {
+            return false;
+        }
+        form_.emplace_back(std::string_view(data, keyLength), std::string_view(equal + 1, valueLength));
+        data = pairEnd + 1;
     }
+    return true;
+}
 
-    bzero(order, sizeof(order));
-    snprintf(order, sizeof(order), "INSERT INTO tb_auth(username, password) VALUES('%s','%s')", username.c_str(), password.c_str());
-    if (mysql_query(mysqlConn.get(), order)) {
-        path_ = "/error.html";
-        mysql_free_result(result);
-        return;
+std::optional<std::string_view> RequestParser::GetFormValue(std::string_view name) const
+{
+    // the last occurrence wins
+    for (auto iter = form_.rbegin(); iter != form_.rend(); ++iter) {
+        if (iter->first == name) {
+            return iter->second;
+        }
     }
-    path_ = "/home.html";
-    mysql_free_result(result);
+    return std::nullopt;
 }
 
 RequestParser::RetStatus RequestParser::Parse(ReadBuffer &rdbuf)
 {
     while (parseStatus_ != ParseStatus::FINISH) {
-        std::optional<std::string> ret = std::nullopt;
-
-        if (parseStatus_ == ParseStatus::BODY) {
-            std::size_t length = std::stoi(header_["Content-Length"]);
-            if (length <= rdbuf.Size()) {
-                ret = rdbuf.GetBytes(length);
+        // body bytes are moved out as they arrive, reads stop at ReadLimit so a refused body is never buffered whole
+        if (parseStatus_ == ParseStatus::BODY || parseStatus_ == ParseStatus::CHUNK_DATA) {
+            if (remaining_ != 0) {
+                if (rdbuf.Empty()) {
+                    return RetStatus::NO_REQUEST;
+                }
+                auto bytes = rdbuf.GetBytes(remaining_).value();
+                body_.append(bytes);
+                remaining_ -= bytes.size();
+                continue;
             }
-        }
-        else {
-            ret = rdbuf.GetLine();
+            if (parseStatus_ == ParseStatus::CHUNK_DATA) {
+                parseStatus_ = ParseStatus::CHUNK_CRLF;
+                continue;
+            }
+            parseStatus_ = ParseStatus::FINISH;
+            continue;
         }
 
+        auto ret = rdbuf.GetLine();
         if (ret == std::nullopt) {
+            // without a CRLF everything buffered belongs to the current line
+            if (rdbuf.Size() > MAX_LINE_SIZE) {
+                MLOG_DEBUG("Parse line too long!");
+                return RetStatus::BAD_REQUEST;
+            }
             return RetStatus::NO_REQUEST;
         }
-        auto line = std::move(ret.value());
+        auto line = ret.value();
+        if (line.size() > MAX_LINE_SIZE) {
+            MLOG_DEBUG("Parse line too long!");
+            return RetStatus::BAD_REQUEST;
+        }
 
         if (parseStatus_ == ParseStatus::HEADER && line.empty()) {
             if (method_ == "POST") {
-                parseStatus_ = ParseStatus::BODY;
+                if (auto status = StartBody(); status != RetStatus::NO_REQUEST) {
+                    MLOG_DEBUG("Parse body refused!");
+                    return status;
+                }
                 continue;
             }
             parseStatus_ = ParseStatus::FINISH;
             continue;
         }
 
+        std::size_t size = 0;
         switch (parseStatus_) {
         case ParseStatus::REQUESTLINE:
             if (!ParseRequestLine(line)) {
                 MLOG_DEBUG("Parse request line failed!");
                 return RetStatus::BAD_REQUEST;
             }
-            FormatPath();
             parseStatus_ = ParseStatus::HEADER;
             break;
         case ParseStatus::HEADER:
@@ -182,13 +232,29 @@ RequestParser::RetStatus RequestParser::Parse(ReadBuffer &rdbuf)
                 return RetStatus::BAD_REQUEST;
             }
             break;
-        case ParseStatus::BODY:
-            if (!ParseBody(line)) {
-                MLOG_DEBUG("Parse body failed!");
+        case ParseStatus::CHUNK_SIZE:
+            if (!ParseChunkSize(line, size)) {
+                MLOG_DEBUG("Parse chunk size failed!");
                 return RetStatus::BAD_REQUEST;
             }
-            UserVerify();
-            parseStatus_ = ParseStatus::FINISH;
+            if (size > MaxBodySize - body_.size()) {
+                return RetStatus::TOO_LARGE;
+            }
+            remaining_ = size;
+            parseStatus_ = size == 0 ? ParseStatus::CHUNK_TRAILER : ParseStatus::CHUNK_DATA;
+            break;
+        case ParseStatus::CHUNK_CRLF:
+            if (!line.empty()) {
+                MLOG_DEBUG("Parse chunk end failed!");
+                return RetStatus::BAD_REQUEST;
+            }
+            parseStatus_ = ParseStatus::CHUNK_SIZE;
+            break;
+        case ParseStatus::CHUNK_TRAILER:
+            // trailer fields are skipped, an empty line ends the body
+            if (line.empty()) {
+                parseStatus_ = ParseStatus::FINISH;
+            }
             break;
         default:
             MLOG_DEBUG("Parse unknown error!");
@@ -4,60 +4,217 @@
 
 namespace msv::http {
 
-ResponseData ResponseMaker::Make(const Path& resPath, int code, bool isKeepAlive)
+ResponseData ResponseMaker::Make(const Path& resPath, int code, bool isKeepAlive, const RequestOptions& options)
 {
-    if (code != 200 && code != 400 && code != 404) {
+    if (code != 200 && !IsErrorCode(code)) {
         MLOG_WARNN("Response maker unsupported code: ", code);
         code = 400;
     }
 
-    std::size_t resSize = 0;
-    void* resMmPtr = nullptr;
-    if (std::filesystem::exists(resPath) && !std::filesystem::is_directory(resPath)) {
-        auto resFd = open(resPath.c_str(), O_RDONLY);
-        if (resFd < 0) {
-            MLOG_WARNN("Response maker open file failed! path: ", resPath.c_str());
-            code = 404;
-        }
-        Reset();
-        resSize = std::filesystem::file_size(resPath);
-        resMmPtr = mmap(0, resSize, PROT_READ, MAP_PRIVATE, resFd, 0);
-        if (*reinterpret_cast<int*>(resMmPtr) == -1) {
-            MLOG_WARNN("Response maker mmap file failed! path: ", resPath.c_str());
-            code = 404;
+    if (code == 200) {
+        auto file = FileCache::Instance()->Get(resPath);
+        if (file != nullptr) {
+            // If-Range only holds while the representation is unchanged, otherwise send it whole
+            auto useRange = options.ranges != nullptr && (options.ifRange.empty() || options.ifRange == file->lastModified || options.ifRange == file->etag);
+            if (!useRange && file->compressible) {
+                file = FileCache::Instance()->GetEncoded(resPath, file, PickEncoding(options.encodings));
+            }
+            // preconditions are evaluated before Range, against the representation that would be sent
+            if (IsNotModified(*file, options.conditions)) {
+                return {file->notModified[isKeepAlive], nullptr, 0, file};
+            }
+            if (useRange) {
+                return MakeRange(file, isKeepAlive, options);
+            }
+            return MakeFull(file, isKeepAlive);
         }
-        mmapInfo_ = {resMmPtr, resSize};
-        close(resFd);
-    } else {
         MLOG_WARNN("Resource file not exist or is a directory! path: ", resPath.c_str());
         code = 404;
     }
 
-    std::string header;
-    header += "HTTP/1.1 " + std::to_string(code) + " " + GetCodeStatus(code) + "\r\n";
+    const auto& errorBody = GetErrorBody(code);
+    return {GetErrorHeader(code, isKeepAlive), errorBody.c_str(), errorBody.length(), nullptr};
+}
+
+ResponseData ResponseMaker::MakeFull(const CachedFilePtr& file, bool isKeepAlive)
+{
+    if (file->fd >= 0) {
+        return {file->header[isKeepAlive], nullptr, 0, file, file->fd, 0, file->size};
+    }
+    return {file->header[isKeepAlive], file->data, file->size, file};
+}
+
+ResponseData ResponseMaker::MakeRange(const CachedFilePtr& file, bool isKeepAlive, const RequestOptions& options)
+{
+    auto size = static_cast<int64_t>(file->size);
+
+    // resolve against the file length, unsatisfiable ranges are dropped
+    std::vector<ByteRange> ranges;
+    for (const auto& range : *options.ranges) {
+        if (range.first < 0) {
+            auto length = std::min(range.last, size);
+            if (length > 0) {
+                ranges.push_back({size - length, size - 1});
+            }
+            continue;
+        }
+        if (range.first < size) {
+            ranges.push_back({range.first, (range.last < 0 || range.last >= size) ? size - 1 : range.last});
+        }
+    }
+
+    // overlapping ranges would send parts of the file over and over (RFC 9110 section 14.2), they are coalesced
+    int64_t total = 0;
+    for (const auto& range : ranges) {
+        total += range.last - range.first + 1;
+    }
+    if (total > size) {
+        std::sort(ranges.begin(), ranges.end(), [](const ByteRange& lhs, const ByteRange& rhs) { return lhs.first < rhs.first; });
+        std::size_t count = 0;
+        for (const auto& range : ranges) {
+            if (count != 0 && range.first <= ranges[count - 1].last + 1) {
+                ranges[count - 1].last = std::max(ranges[count - 1].last, range.last);
+                continue;
+            }
+            ranges[count++] = range;
+        }
+        ranges.resize(count);
+    }
+
+    if (ranges.empty()) {
+        auto extra = "Content-Range: bytes */" + std::to_string(size) + "\r\n";
+        auto storage = std::make_shared<std::string>(MakeHeader(416, isKeepAlive, "text/html", 0, extra));
+        return {*storage, nullptr, 0, nullptr, -1, 0, 0, storage};
+    }
+    if (ranges.size() > 1) {
+        return MakeMultipart(file, isKeepAlive, ranges);
+    }
+
+    auto [first, last] = ranges[0];
+    auto length = static_cast<std::size_t>(last - first + 1);
+    auto extra = "Accept-Ranges: bytes\r\nETag: " + file->etag + "\r\nLast-Modified: " + file->lastModified + "\r\n"
+        + "Cache-Control: " + file->cacheControl + "\r\n"
+        + (file->compressible ? "Vary: Accept-Encoding\r\n" : "")
+        + "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size) + "\r\n";
+    auto storage = std::make_shared<std::string>(MakeHeader(206, isKeepAlive, file->contentType, length, extra));
+    if (file->fd >= 0) {
+        return {*storage, nullptr, 0, file, file->fd, static_cast<off_t>(first), length, storage};
+    }
+    return {*storage, file->data + first, length, file, -1, 0, 0, storage};
+}
+
+ResponseData ResponseMaker::MakeMultipart(const CachedFilePtr& file, bool isKeepAlive, const std::vector<ByteRange>& ranges)
+{
+    static constexpr std::string_view boundary = "MSV_BYTERANGES_BOUNDARY";
+
+    // part headers are laid out back to back, the part bodies are chained from the file instead of copied
+    auto size = std::to_string(file->size);
+    std::string parts;
+    std::vector<std::size_t> partEnds;
+    std::size_t total = 0;
+    for (const auto& [first, last] : ranges) {
+        parts.append("\r\n--").append(boundary).append("\r\n");
+        parts.append("Content-Type: ").append(file->contentType).append("\r\n");
+        parts.append("Content-Range: bytes ").append(std::to_string(first)).append("-").append(std::to_string(last)).append("/").append(size).append("\r\n\r\n");
+        partEnds.push_back(parts.size());
+        total += last - first + 1;
+    }
+    parts.append("\r\n--").append(boundary).append("--\r\n");
+
+    auto contentType = "multipart/byteranges; boundary=" + std::string(boundary);
+    auto storage = std::make_shared<std::string>(MakeHeader(206, isKeepAlive, contentType, parts.size() + total, "Accept-Ranges: bytes\r\n"));
+    auto headerLength = storage->size();
+    storage->append(parts);
+
+    ResponseData response{std::string_view(*storage).substr(0, headerLength), nullptr, 0, file, -1, 0, 0, storage};
+    response.chain.reserve(ranges.size() * 2 + 1);
+    auto begin = headerLength;
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        auto end = headerLength + partEnds[i];
+        response.chain.push_back({storage->data() + begin, end - begin});
+        auto length = static_cast<std::size_t>(ranges[i].last - ranges[i].first + 1);
+        if (file->fd >= 0) {
+            response.chain.push_back({nullptr, length, file->fd, static_cast<off_t>(ranges[i].first)});
+        }
+        else {
+            response.chain.push_back({file->data + ranges[i].first, length});
+        }
+        begin = end;
+    }
+    response.chain.push_back({storage->data() + begin, storage->size() - begin});
+    return response;
+}
+
+ResponseData ResponseMaker::MakeText(int code, bool isKeepAlive, const std::string& contentType, const std::string& body)
+{
+    auto storage = std::make_shared<std::string>(MakeHeader(code, isKeepAlive, contentType, body.size()));
+    auto headerLength = storage->size();
+    storage->append(body);
+    return {std::string_view(*storage).substr(0, headerLength), storage->data() + headerLength, body.size(), nullptr, -1, 0, 0, storage};
+}
+
+ResponseData ResponseMaker::MakeError(int code, bool isKeepAlive, std::string_view extra)
+{
+    const auto& errorBody = GetErrorBody(code);
+    auto storage = std::make_shared<std::string>(MakeHeader(code, isKeepAlive, "text/html", errorBody.length(), extra));
+    return {*storage, errorBody.c_str(), errorBody.length(), nullptr, -1, 0, 0, storage};
+}
+
+ResponseData ResponseMaker::MakeStream(int code, bool isKeepAlive, const std::string& contentType, std::shared_ptr<BodyProducer> producer)
+{
+    auto storage = std::make_shared<std::string>(MakeHeaderFields(code, isKeepAlive, contentType, {}) + "Transfer-Encoding: chunked\r\n\r\n");
+    ResponseData response{*storage, nullptr, 0, nullptr, -1, 0, 0, storage};
+    response.producer = std::move(producer);
+    response.chunked = true;
+    return response;
+}
+
+std::string ResponseMaker::MakeHeader(int code, bool isKeepAlive, const std::string& contentType, std::size_t contentLength, std::string_view extra)
+{
+    return MakeHeaderFields(code, isKeepAlive, contentType, extra) + "Content-length: " + std::to_string(contentLength) + "\r\n\r\n";
+}
+
+std::string ResponseMaker::MakeHeaderFields(int code, bool isKeepAlive, const std::string& contentType, std::string_view extra)
+{
+    std::string header = GetResponseLine(code);
     if (isKeepAlive) {
         header += "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n";
     } else {
         header += "Connection: close\r\n";
     }
-    if (code == 200) {
-        header += GetContentType(resPath);
-    } else {
-        header += "Content-type: text/html\r\n";
-    }
+    header += "Content-type: " + contentType + "\r\n";
+    header += extra;
+    return header;
+}
 
-    const char* body = nullptr;
-    if (code == 200) {
-        header += "Content-length: " + std::to_string(resSize) + "\r\n\r\n";
-        body = reinterpret_cast<const char*>(resMmPtr);
-    } else {
-        const auto& errorBody = GetErrorBody(code);
-        resSize = errorBody.length();
-        header += "Content-length: " + std::to_string(resSize) + "\r\n\r\n";
-        body = errorBody.c_str();
-    }
+std::string ResponseMaker::FormatHttpDate(time_t time)
+{
+    struct tm tm{};
+    gmtime_r(&time, &tm);
+    char buffer[64] = {0};
+    auto len = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buffer, len);
+}
 
-    return {header, body, resSize};
+std::string ResponseMaker::GetCacheControl(const Path& resPath)
+{
+    // pages are revalidated on every load, the assets they pull in are reused for a day
+    static const std::map<std::string, std::string> mapping = {
+        {".html", "no-cache"},
+        {".xhtml", "no-cache"},
+        {".css", "public, max-age=86400"},
+        {".js", "public, max-age=86400"},
+        {".png", "public, max-age=86400"},
+        {".gif", "public, max-age=86400"},
+        {".jpg", "public, max-age=86400"},
+        {".jpeg", "public, max-age=86400"},
+        {".mp4", "public, max-age=86400"},
+    };
+    auto iter = mapping.find(resPath.extension().string());
+    if (iter == mapping.end()) {
+        return "public, max-age=3600";
+    }
+    return iter->second;
 }
 
 std::string ResponseMaker::GetContentType(const Path &resPath)
@@ -86,9 +243,9 @@ std::string ResponseMaker::GetContentType(const Path &resPath)
     auto ext = resPath.extension().string();
     auto iter = mapping.find(ext);
     if (iter == mapping.end()) {
-        return "Content-type: text/plain\r\n";
+        return "text/plain";
     }
-    return "Content-type: " + iter->second + "\r\n";
+    return iter->second;
 }
 
-}
\ No newline at end of file
+}
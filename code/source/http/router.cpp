@@ -0,0 +1,204 @@
+// Author: cute-giggle@outlook.com
+
+#include <algorithm>
+
+#include "http/router.h"
+
+namespace msv::http {
+
+void Exchange::RespondError(int code)
+{
+    if (code == 400 || code == 413) {
+        keepAlive_ = false;
+    }
+    response_ = responseMaker_.Make({}, code, keepAlive_);
+}
+
+void Exchange::RespondNotAllowed(std::string_view allow)
+{
+    response_ = ResponseMaker::MakeError(405, keepAlive_, "Allow: " + std::string(allow) + "\r\n");
+}
+
+void Exchange::ServeFile(const std::string& path)
+{
+    RequestOptions options{};
+    options.ranges = request_.ParseRange();
+    options.ifRange = request_.GetHeader(HeaderField::IF_RANGE);
+    options.encodings = ParseAcceptEncoding(request_.GetHeader(HeaderField::ACCEPT_ENCODING));
+    options.conditions = request_.ParseConditions();
+    response_ = responseMaker_.Make(path, 200, keepAlive_, options);
+}
+
+std::string_view Router::NextSegment(std::string_view& path)
+{
+    while (!path.empty() && path.front() == '/') {
+        path.remove_prefix(1);
+    }
+    auto segment = path.substr(0, path.find('/'));
+    path.remove_prefix(segment.size());
+    return segment;
+}
+
+Router::Node* Router::Insert(std::string_view pattern, std::size_t& numParams)
+{
+    auto node = &root_;
+    for (auto segment = NextSegment(pattern); !segment.empty(); segment = NextSegment(pattern)) {
+        if (segment.front() == ':') {
+            auto name = segment.substr(1);
+            if (node->param == nullptr) {
+                node->param = std::make_unique<Node>();
+                node->param->segment = name;
+            }
+            // one parameter node per level, its name is fixed by the first route through it
+            if (node->param->segment != name) {
+                return nullptr;
+            }
+            node = node->param.get();
+            ++numParams;
+            continue;
+        }
+
+        auto iter = std::find_if(node->children.begin(), node->children.end(), [segment](const auto& child) {
+            return child->segment == segment;
+        });
+        if (iter == node->children.end()) {
+            node->children.push_back(std::make_unique<Node>());
+            node->children.back()->segment = segment;
+            iter = node->children.end() - 1;
+        }
+        node = iter->get();
+    }
+    return node;
+}
+
+bool Router::Add(const Route& route)
+{
+    std::size_t numParams = 0;
+    auto node = Insert(route.pattern, numParams);
+    if (node == nullptr || route.method == Method::UNKNOWN || numParams > Exchange::MAX_PARAMS) {
+        MLOG_ERROR("Router invalid route! pattern: ", route.pattern);
+        return false;
+    }
+    auto& slot = node->routes[static_cast<std::size_t>(route.method)];
+    if (slot != nullptr) {
+        MLOG_ERROR("Router route already taken! pattern: ", route.pattern);
+        return false;
+    }
+    routes_.push_back(std::make_unique<Route>(route));
+    slot = routes_.back().get();
+    return true;
+}
+
+void Router::Mount(std::string_view prefix, const std::string& dir)
+{
+    std::size_t numParams = 0;
+    auto node = Insert(prefix, numParams);
+    if (node == nullptr || numParams != 0) {
+        MLOG_ERROR("Router invalid mount! prefix: ", prefix);
+        return;
+    }
+    node->mount = dir;
+    node->mounted = true;
+}
+
+const Router::Node* Router::Lookup(std::string_view path, const Node*& mount, Exchange* exchange) const
+{
+    const Node* node = &root_;
+    mount = root_.mounted ? &root_ : nullptr;
+    if (exchange != nullptr) {
+        exchange->tail_ = path;
+    }
+    for (auto segment = NextSegment(path); !segment.empty(); segment = NextSegment(path)) {
+        const Node* next = nullptr;
+        for (const auto& child : node->children) {
+            if (child->segment == segment) {
+                next = child.get();
+                break;
+            }
+        }
+        if (next == nullptr && node->param != nullptr) {
+            next = node->param.get();
+            if (exchange != nullptr) {
+                exchange->params_[exchange->numParams_++] = {next->segment, segment};
+            }
+        }
+        if (next == nullptr) {
+            return nullptr;
+        }
+        node = next;
+        if (node->mounted) {
+            mount = node;
+            if (exchange != nullptr) {
+                exchange->tail_ = path;
+            }
+        }
+    }
+    return node;
+}
+
+bool Router::Takes(Method method, std::string_view path) const
+{
+    const Node* mount = nullptr;
+    auto node = Lookup(path.substr(0, path.find('?')), mount, nullptr);
+    if (node != nullptr && method != Method::UNKNOWN && node->routes[static_cast<std::size_t>(method)] != nullptr) {
+        return true;
+    }
+    return mount != nullptr && method == Method::GET;
+}
+
+void Router::Dispatch(Exchange& exchange) const
+{
+    auto& request = exchange.Request();
+    auto method = request.GetMethod();
+    auto path = std::string_view(request.GetPath());
+
+    const Node* mount = nullptr;
+    auto node = Lookup(path.substr(0, path.find('?')), mount, &exchange);
+
+    if (node != nullptr && method != Method::UNKNOWN) {
+        if (auto route = node->routes[static_cast<std::size_t>(method)]; route != nullptr) {
+            exchange.route_ = route;
+            route->handler(exchange);
+            if (!exchange.IsDeferred() && exchange.response_.header.empty()) {
+                MLOG_ERROR("Router handler left no response! pattern: ", route->pattern);
+                exchange.RespondError(404);
+            }
+            return;
+        }
+    }
+    exchange.numParams_ = 0;
+    if (mount != nullptr && method == Method::GET) {
+        ServeStatic(exchange, mount->mount);
+        return;
+    }
+
+    // the methods of the routes at the path, and GET for a path below a mount
+    std::string allow;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Method::COUNT); ++i) {
+        auto allowed = (node != nullptr && node->routes[i] != nullptr) || (mount != nullptr && static_cast<Method>(i) == Method::GET);
+        if (allowed) {
+            allow += allow.empty() ? "" : ", ";
+            allow += MethodName(static_cast<Method>(i));
+        }
+    }
+    if (allow.empty()) {
+        exchange.RespondError(404);
+        return;
+    }
+    exchange.RespondNotAllowed(allow);
+}
+
+void Router::ServeStatic(Exchange& exchange, const std::string& dir)
+{
+    // nothing above the mounted directory is reachable
+    auto tail = exchange.Tail();
+    for (auto rest = tail, segment = NextSegment(rest); !segment.empty(); segment = NextSegment(rest)) {
+        if (segment == "..") {
+            exchange.RespondError(404);
+            return;
+        }
+    }
+    exchange.ServeFile(dir + std::string(tail));
+}
+
+}
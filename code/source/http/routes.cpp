@@ -0,0 +1,68 @@
+// Author: cute-giggle@outlook.com
+
+#include "http/routes.h"
+#include "http/auth_handler.h"
+#include "http/http_connection.h"
+
+namespace msv::http {
+
+namespace {
+
+// arg is the page below the resource directory
+void ServePage(Exchange& exchange)
+{
+    exchange.ServeFile(HttpConnection::ResDir.string() + std::string(exchange.Arg()));
+}
+
+// Renders a scrape a section at a time, as fast as the client takes it.
+class MetricsProducer : public BodyProducer {
+public:
+    bool Produce(std::string& out, std::size_t limit, bool& done) override
+    {
+        while (pending_.size() < limit && section_ < Metrics::SECTION_COUNT) {
+            Metrics::RenderSection(snapshot_, section_++, pending_);
+        }
+        auto size = std::min(limit, pending_.size());
+        out.append(pending_, 0, size);
+        pending_.erase(0, size);
+        done = pending_.empty() && section_ == Metrics::SECTION_COUNT;
+        return true;
+    }
+
+private:
+    Metrics::Snapshot snapshot_{Metrics::Instance()->Collect()};
+    std::size_t section_{};
+    std::string pending_{};
+};
+
+void ServeMetrics(Exchange& exchange)
+{
+    static constexpr const char* contentType = "text/plain; version=0.0.4";
+    // chunked framing needs HTTP/1.1
+    if (!exchange.Request().IsHttp11()) {
+        exchange.Respond(ResponseMaker::MakeText(200, exchange.IsKeepAlive(), contentType, Metrics::Instance()->Render()));
+        return;
+    }
+    exchange.Respond(ResponseMaker::MakeStream(200, exchange.IsKeepAlive(), contentType, std::make_shared<MetricsProducer>()));
+}
+
+constexpr Route ROUTES[] = {
+    {Method::GET, "/", &ServePage, "/index.html"},
+    {Method::GET, "/index", &ServePage, "/index.html"},
+    {Method::GET, "/home", &ServePage, "/home.html"},
+    {Method::GET, "/image", &ServePage, "/image.html"},
+    {Method::GET, "/video", &ServePage, "/video.html"},
+    {Method::GET, "/metrics", &ServeMetrics},
+    {Method::POST, "/login", &AuthHandler::Login},
+    {Method::POST, "/register", &AuthHandler::Register},
+};
+
+}
+
+bool InstallRoutes(Router& router, const std::string& resDir)
+{
+    router.Mount("/", resDir);
+    return router.AddAll(ROUTES);
+}
+
+}
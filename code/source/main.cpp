@@ -6,6 +6,7 @@ int main()
 {
     mlog::Collection::instance().addStream(std::shared_ptr<mlog::Stream>(new mlog::ConsoleStream));
     mlog::Collection::instance().setLevel(mlog::Level::L_DEBUG);
+    mlog::Collection::instance().startAsync(std::chrono::milliseconds(100));
 
     msv::HttpConnection::ResDir = "/home/giggle/Workspace/Projects/msv/resources";
 
@@ -25,8 +26,12 @@ int main()
         10000,
         false,
         8,
-        dbConfig
+        dbConfig,
+        std::max(1U, std::thread::hardware_concurrency())
     };
+    svConfig.asyncDb = true;
+    svConfig.ownedConnections = true;
+    svConfig.pollerType = msv::PollerType::IO_URING;
 
     msv::Server server(svConfig);
     server.Start();
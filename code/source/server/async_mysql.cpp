@@ -0,0 +1,364 @@
+// Author: cute-giggle@outlook.com
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "db/async_mysql.h"
+
+namespace msv {
+
+#ifdef MYSQL_WAIT_READ
+
+AsyncMysql::~AsyncMysql()
+{
+    for (auto& link : links_) {
+        if (link.result != nullptr) {
+            mysql_free_result(link.result);
+        }
+        if (link.mysql != nullptr) {
+            mysql_close(link.mysql);
+        }
+    }
+    if (notifyFd_ >= 0) {
+        close(notifyFd_);
+    }
+}
+
+bool AsyncMysql::Initialize(const MysqlConfig& config, uint16_t numConnect, Poller* poller, CallbackType callback, void* owner)
+{
+    config_ = config;
+    poller_ = poller;
+    callback_ = callback;
+    owner_ = owner;
+
+    notifyFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notifyFd_ < 0 || !poller_->AddFd(notifyFd_, EPOLLIN)) {
+        MLOG_ERROR("Async mysql create notify fd failed!");
+        return false;
+    }
+
+    numConnect = std::min(numConnect, MAX_NUM_CONNECT);
+    for (auto i = 0U; i < numConnect; ++i) {
+        auto ptr = mysql_init(nullptr);
+        if (ptr == nullptr) {
+            MLOG_ERROR("Async mysql initialize failed!");
+            return false;
+        }
+        mysql_options(ptr, MYSQL_OPT_NONBLOCK, nullptr);
+        // the first connect happens at startup, the blocking call is fine here
+        if (mysql_real_connect(ptr, config.host.c_str(), config.user.c_str(), config.passwd.c_str(), config.dbname.c_str(), config.port, nullptr, 0) == nullptr) {
+            MLOG_ERROR("Async mysql connected failed!");
+            mysql_close(ptr);
+            return false;
+        }
+        Link link{};
+        link.mysql = ptr;
+        link.fd = mysql_get_socket(ptr);
+        // armed only while a query waits, so a server side close of an idle link stays silent
+        poller_->AddFd(link.fd, EPOLLONESHOT);
+        links_.push_back(std::move(link));
+    }
+    MLOG_INFOR("Async mysql initialize success! connections: ", links_.size());
+    return true;
+}
+
+void AsyncMysql::Submit(VerifyJob&& job)
+{
+    if (links_.empty()) {
+        callback_(owner_, job.handle, false);
+        return;
+    }
+    {
+        std::lock_guard locker(mutex_);
+        incoming_.push_back(std::move(job));
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = write(notifyFd_, &one, sizeof(one));
+}
+
+bool AsyncMysql::HandleEvent(int fd, uint32_t events)
+{
+    if (fd < 0) {
+        return false;
+    }
+    if (fd == notifyFd_) {
+        uint64_t count = 0;
+        [[maybe_unused]] auto ret = read(notifyFd_, &count, sizeof(count));
+        {
+            std::lock_guard locker(mutex_);
+            for (auto& job : incoming_) {
+                pending_.push_back(std::move(job));
+            }
+            incoming_.clear();
+        }
+        Dispatch();
+        return true;
+    }
+
+    for (auto& link : links_) {
+        if (link.fd != fd) {
+            continue;
+        }
+        if (link.stage == Stage::IDLE || link.stage == Stage::BROKEN) {
+            return true;
+        }
+        int status = 0;
+        status |= (events & EPOLLIN) ? MYSQL_WAIT_READ : 0;
+        status |= (events & EPOLLOUT) ? MYSQL_WAIT_WRITE : 0;
+        status |= (events & (EPOLLERR | EPOLLHUP)) ? MYSQL_WAIT_EXCEPT : 0;
+        Progress(link, Continue(link, status));
+        return true;
+    }
+    return false;
+}
+
+void AsyncMysql::Dispatch()
+{
+    for (auto& link : links_) {
+        if (pending_.empty()) {
+            return;
+        }
+        if (link.stage == Stage::BROKEN) {
+            Connect(link);
+        }
+        if (link.stage != Stage::IDLE) {
+            continue;
+        }
+        link.job = std::move(pending_.front());
+        pending_.pop_front();
+        Start(link);
+    }
+    FailStranded();
+}
+
+void AsyncMysql::Connect(Link& link)
+{
+    link.mysql = mysql_init(nullptr);
+    if (link.mysql == nullptr) {
+        MLOG_ERROR("Async mysql initialize failed!");
+        return;
+    }
+    mysql_options(link.mysql, MYSQL_OPT_NONBLOCK, nullptr);
+    link.stage = Stage::CONNECT;
+    auto status = mysql_real_connect_start(&link.connected, link.mysql, config_.host.c_str(), config_.user.c_str(), config_.passwd.c_str(), config_.dbname.c_str(), config_.port, nullptr, 0);
+    // the socket exists once the connect is under way
+    link.fd = mysql_get_socket(link.mysql);
+    if (link.fd >= 0) {
+        poller_->AddFd(link.fd, EPOLLONESHOT);
+    }
+    Progress(link, status);
+}
+
+void AsyncMysql::Drop(Link& link)
+{
+    if (link.result != nullptr) {
+        mysql_free_result(link.result);
+        link.result = nullptr;
+    }
+    // deregistered before the close, the fd number may be handed out again right away
+    if (link.fd >= 0) {
+        poller_->DelFd(link.fd);
+        link.fd = -1;
+    }
+    if (link.mysql != nullptr) {
+        mysql_close(link.mysql);
+        link.mysql = nullptr;
+    }
+    link.stage = Stage::BROKEN;
+}
+
+void AsyncMysql::Lost(Link& link)
+{
+    MLOG_ERROR("Async mysql connection lost, reconnect! ", mysql_error(link.mysql));
+    auto job = std::move(link.job);
+    Drop(link);
+    if (job.retried) {
+        Metrics::Observe(Histogram::DB, link.start);
+        callback_(owner_, job.handle, false);
+    }
+    else {
+        job.retried = true;
+        pending_.push_front(std::move(job));
+    }
+    Connect(link);
+    Dispatch();
+}
+
+void AsyncMysql::FailStranded()
+{
+    auto alive = std::any_of(links_.begin(), links_.end(), [](const Link& link) { return link.stage != Stage::BROKEN; });
+    if (alive) {
+        return;
+    }
+    while (!pending_.empty()) {
+        auto job = std::move(pending_.front());
+        pending_.pop_front();
+        callback_(owner_, job.handle, false);
+    }
+}
+
+bool AsyncMysql::BuildQuery(Link& link, const char* format)
+{
+    const auto& username = link.job.username;
+    const auto& password = link.job.password;
+    if (username.size() > MAX_FIELD_LENGTH || password.size() > MAX_FIELD_LENGTH) {
+        return false;
+    }
+
+    char escapedName[MAX_FIELD_LENGTH * 2 + 1] = {0};
+    char escapedPassword[MAX_FIELD_LENGTH * 2 + 1] = {0};
+    mysql_real_escape_string(link.mysql, escapedName, username.c_str(), username.size());
+    mysql_real_escape_string(link.mysql, escapedPassword, password.c_str(), password.size());
+
+    char order[512] = {0};
+    auto len = snprintf(order, sizeof(order), format, escapedName, escapedPassword);
+    link.query.assign(order, len);
+    return true;
+}
+
+void AsyncMysql::Start(Link& link)
+{
+    if (!BuildQuery(link, "SELECT username, password FROM tb_auth WHERE username='%s' LIMIT 1")) {
+        Finish(link, false);
+        return;
+    }
+    link.stage = Stage::SELECT;
+    link.start = Metrics::Clock::now();
+    link.job.epoch = CredentialCache::Instance()->Epoch(link.job.username);
+    Progress(link, mysql_real_query_start(&link.error, link.mysql, link.query.c_str(), link.query.size()));
+}
+
+int AsyncMysql::Continue(Link& link, int status)
+{
+    switch (link.stage) {
+    case Stage::CONNECT:
+        return mysql_real_connect_cont(&link.connected, link.mysql, status);
+    case Stage::SELECT:
+    case Stage::INSERT:
+        return mysql_real_query_cont(&link.error, link.mysql, status);
+    case Stage::STORE:
+        return mysql_store_result_cont(&link.result, link.mysql, status);
+    default:
+        return 0;
+    }
+}
+
+void AsyncMysql::Progress(Link& link, int status)
+{
+    // status 0 means the current step is done, otherwise it says what the client library waits for
+    while (status == 0) {
+        switch (link.stage) {
+        case Stage::CONNECT:
+            if (link.connected == nullptr) {
+                MLOG_ERROR("Async mysql reconnect failed! ", mysql_error(link.mysql));
+                Drop(link);
+                FailStranded();
+                return;
+            }
+            MLOG_INFOR("Async mysql reconnected!");
+            link.stage = Stage::IDLE;
+            Dispatch();
+            return;
+        case Stage::SELECT:
+            if (link.error && IsConnectionLost(link.mysql)) {
+                Lost(link);
+                return;
+            }
+            if (link.error) {
+                MLOG_ERROR("Async mysql query failed! ", mysql_error(link.mysql));
+                Finish(link, false);
+                return;
+            }
+            link.stage = Stage::STORE;
+            status = mysql_store_result_start(&link.result, link.mysql);
+            break;
+        case Stage::STORE: {
+            if (link.result == nullptr && IsConnectionLost(link.mysql)) {
+                Lost(link);
+                return;
+            }
+            if (link.result == nullptr) {
+                Finish(link, false);
+                return;
+            }
+            auto numRows = mysql_num_rows(link.result);
+            auto row = numRows ? mysql_fetch_row(link.result) : nullptr;
+            auto matched = row != nullptr && row[1] != nullptr && link.job.password == row[1];
+            if (row != nullptr && row[1] != nullptr) {
+                CredentialCache::Instance()->Store(link.job.username, row[1], link.job.epoch);
+            }
+            else if (numRows == 0) {
+                CredentialCache::Instance()->StoreAbsent(link.job.username, link.job.epoch);
+            }
+            mysql_free_result(link.result);
+            link.result = nullptr;
+
+            // login needs a matching row, register needs no row at all
+            if (link.job.isLogin || numRows) {
+                Finish(link, link.job.isLogin && matched);
+                return;
+            }
+            BuildQuery(link, "INSERT INTO tb_auth(username, password) VALUES('%s','%s')");
+            link.stage = Stage::INSERT;
+            status = mysql_real_query_start(&link.error, link.mysql, link.query.c_str(), link.query.size());
+            break;
+        }
+        case Stage::INSERT:
+            if (link.error && IsConnectionLost(link.mysql)) {
+                Lost(link);
+                return;
+            }
+            if (link.error == 0) {
+                CredentialCache::Instance()->Invalidate(link.job.username);
+            }
+            Finish(link, link.error == 0);
+            return;
+        default:
+            return;
+        }
+    }
+
+    uint32_t events = EPOLLONESHOT;
+    events |= (status & MYSQL_WAIT_READ) ? EPOLLIN : 0;
+    events |= (status & MYSQL_WAIT_WRITE) ? EPOLLOUT : 0;
+    poller_->ModFd(link.fd, events);
+}
+
+void AsyncMysql::Finish(Link& link, bool success)
+{
+    if (link.stage != Stage::IDLE) {
+        Metrics::Observe(Histogram::DB, link.start);
+    }
+    link.stage = Stage::IDLE;
+    callback_(owner_, link.job.handle, success);
+    Dispatch();
+}
+
+#else
+
+// the client library has no non-blocking API (not MariaDB Connector/C), every job fails fast
+
+AsyncMysql::~AsyncMysql() = default;
+
+bool AsyncMysql::Initialize(const MysqlConfig&, uint16_t, Poller*, CallbackType callback, void* owner)
+{
+    callback_ = callback;
+    owner_ = owner;
+    MLOG_ERROR("Async mysql unsupported by the mysql client library!");
+    return false;
+}
+
+void AsyncMysql::Submit(VerifyJob&& job)
+{
+    callback_(owner_, job.handle, false);
+}
+
+bool AsyncMysql::HandleEvent(int, uint32_t)
+{
+    return false;
+}
+
+#endif
+
+}
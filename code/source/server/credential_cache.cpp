@@ -0,0 +1,129 @@
+// Author: cute-giggle@outlook.com
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#include "db/credential_cache.h"
+
+namespace msv {
+
+void CredentialCache::Initialize(std::size_t capacity, uint32_t ttl, uint32_t negativeTtl)
+{
+    shardCapacity_ = (capacity + SHARD_COUNT - 1) / SHARD_COUNT;
+    ttl_ = std::chrono::milliseconds(ttl);
+    negativeTtl_ = std::chrono::milliseconds(negativeTtl);
+}
+
+CredentialCache::Shard& CredentialCache::ShardOf(std::string_view username)
+{
+    return shards_[std::hash<std::string_view>{}(username) % SHARD_COUNT];
+}
+
+CredentialCache::Digest CredentialCache::Hash(const std::array<unsigned char, SALT_SIZE>& salt, std::string_view password)
+{
+    std::string input(reinterpret_cast<const char*>(salt.data()), salt.size());
+    input.append(password);
+    Digest digest{};
+    SHA256(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest.data());
+    return digest;
+}
+
+CredentialCache::Result CredentialCache::Check(std::string_view username, std::string_view password)
+{
+    if (shardCapacity_ == 0) {
+        return Result::MISS;
+    }
+
+    auto& shard = ShardOf(username);
+    Entry entry{};
+    {
+        std::lock_guard locker(shard.mutex);
+        auto iter = shard.index.find(username);
+        if (iter == shard.index.end()) {
+            return Result::MISS;
+        }
+        if (Clock::now() >= iter->second->expire) {
+            shard.entries.erase(iter->second);
+            shard.index.erase(iter);
+            return Result::MISS;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, iter->second);
+        if (!iter->second->exists) {
+            return Result::ABSENT;
+        }
+        entry.salt = iter->second->salt;
+        entry.digest = iter->second->digest;
+    }
+
+    // hashing happens outside the shard lock
+    auto digest = Hash(entry.salt, password);
+    return CRYPTO_memcmp(digest.data(), entry.digest.data(), digest.size()) == 0 ? Result::MATCH : Result::MISMATCH;
+}
+
+uint64_t CredentialCache::Epoch(std::string_view username)
+{
+    return ShardOf(username).epoch.load(std::memory_order_acquire);
+}
+
+void CredentialCache::Store(std::string_view username, std::string_view password, uint64_t epoch)
+{
+    if (shardCapacity_ == 0) {
+        return;
+    }
+
+    Entry entry{};
+    entry.username = username;
+    entry.exists = true;
+    if (RAND_bytes(entry.salt.data(), entry.salt.size()) != 1) {
+        return;
+    }
+    entry.digest = Hash(entry.salt, password);
+    entry.expire = Clock::now() + ttl_;
+    Insert(std::move(entry), epoch);
+}
+
+void CredentialCache::StoreAbsent(std::string_view username, uint64_t epoch)
+{
+    if (shardCapacity_ == 0) {
+        return;
+    }
+
+    Entry entry{};
+    entry.username = username;
+    entry.expire = Clock::now() + negativeTtl_;
+    Insert(std::move(entry), epoch);
+}
+
+void CredentialCache::Insert(Entry&& entry, uint64_t epoch)
+{
+    auto& shard = ShardOf(entry.username);
+    std::lock_guard locker(shard.mutex);
+    // e.g. an absence read before a register's insert landed
+    if (shard.epoch.load(std::memory_order_relaxed) != epoch) {
+        return;
+    }
+    if (auto iter = shard.index.find(entry.username); iter != shard.index.end()) {
+        shard.entries.erase(iter->second);
+        shard.index.erase(iter);
+    }
+    while (shard.entries.size() >= shardCapacity_) {
+        shard.index.erase(shard.entries.back().username);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front(std::move(entry));
+    // the key views the username owned by the list node, which never moves
+    shard.index.emplace(shard.entries.front().username, shard.entries.begin());
+}
+
+void CredentialCache::Invalidate(std::string_view username)
+{
+    auto& shard = ShardOf(username);
+    std::lock_guard locker(shard.mutex);
+    shard.epoch.fetch_add(1, std::memory_order_release);
+    if (auto iter = shard.index.find(username); iter != shard.index.end()) {
+        shard.entries.erase(iter->second);
+        shard.index.erase(iter);
+    }
+}
+
+}
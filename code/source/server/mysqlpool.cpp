@@ -4,66 +4,180 @@
 
 namespace msv {
 
-MYSQL* MysqlPool::GetConnection()
+namespace {
+
+constexpr const char* STATEMENT_SQL[] = {
+    "SELECT password FROM tb_auth WHERE username=? LIMIT 1",
+    "INSERT INTO tb_auth(username, password) VALUES(?, ?)",
+};
+
+// slot the calling thread leased last time, it is tried first to keep connections thread-affine
+thread_local std::size_t preferredSlot = std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+}
+
+MYSQL_STMT* MysqlConnection::GetStatement(MysqlStatement id)
+{
+    auto& stmt = statements[static_cast<std::size_t>(id)];
+    if (stmt != nullptr) {
+        return stmt;
+    }
+    stmt = mysql_stmt_init(mysql);
+    if (stmt == nullptr) {
+        MLOG_ERROR("Mysql statement initialize failed!");
+        return nullptr;
+    }
+    auto sql = STATEMENT_SQL[static_cast<std::size_t>(id)];
+    if (mysql_stmt_prepare(stmt, sql, strlen(sql))) {
+        MLOG_ERROR("Mysql statement prepare failed! ", mysql_stmt_error(stmt));
+        auto lost = IsConnectionLost(stmt);
+        mysql_stmt_close(stmt);
+        stmt = nullptr;
+        if (lost) {
+            Reset();
+        }
+    }
+    return stmt;
+}
+
+bool MysqlConnection::Fail(MYSQL_STMT* stmt)
+{
+    if (mysql == nullptr) {
+        return true;
+    }
+    if (stmt != nullptr ? !IsConnectionLost(stmt) : !IsConnectionLost(mysql)) {
+        return false;
+    }
+    MLOG_INFOR("Mysql connection lost, reconnect on next lease!");
+    Reset();
+    return true;
+}
+
+void MysqlConnection::Reset()
 {
-    std::unique_lock locker(mutex_);
-    if (queue_.empty()) {
-        cond_.wait(locker);
+    for (auto& stmt : statements) {
+        if (stmt != nullptr) {
+            mysql_stmt_close(stmt);
+            stmt = nullptr;
+        }
     }
-    if (!queue_.empty()) {
-        auto ret = queue_.front();
-        queue_.pop();
-        return ret;
+    if (mysql != nullptr) {
+        mysql_close(mysql);
+        mysql = nullptr;
+    }
+}
+
+MysqlConnection* MysqlPool::TryAcquire()
+{
+    for (std::size_t i = 0; i < numSlots_; ++i) {
+        auto index = (preferredSlot + i) % numSlots_;
+        auto& slot = slots_[index];
+        if (!slot.busy.load(std::memory_order_relaxed) && !slot.busy.exchange(true, std::memory_order_acquire)) {
+            preferredSlot = index;
+            return &slot.conn;
+        }
     }
     return nullptr;
 }
 
-void MysqlPool::RetConnection(MYSQL* ptr)
+MysqlConnection* MysqlPool::GetConnection()
 {
-    if (ptr == nullptr) {
-        return;
+    if (numSlots_ == 0) {
+        return nullptr;
     }
 
-    {
+    auto conn = TryAcquire();
+    if (conn == nullptr) {
         std::unique_lock locker(mutex_);
-        queue_.push(ptr);
+        numWaiting_.fetch_add(1);
+        cond_.wait_for(locker, std::chrono::milliseconds(config_.leaseTimeout), [this, &conn]() {
+            conn = TryAcquire();
+            return conn != nullptr;
+        });
+        numWaiting_.fetch_sub(1);
+    }
+    if (conn == nullptr) {
+        MLOG_ERROR("Mysql lease timeout!");
+        return nullptr;
+    }
+
+    if (!CheckHealth(*conn)) {
+        RetConnection(conn);
+        return nullptr;
+    }
+    return conn;
+}
+
+void MysqlPool::RetConnection(MysqlConnection* conn)
+{
+    if (conn == nullptr) {
+        return;
+    }
+
+    auto index = (reinterpret_cast<char*>(conn) - reinterpret_cast<char*>(slots_.get())) / sizeof(Slot);
+    slots_[index].busy.store(false);
+    if (numWaiting_.load() != 0) {
+        std::lock_guard locker(mutex_);
+        cond_.notify_one();
     }
-    cond_.notify_one();
 }
 
 void MysqlPool::Shutdown()
 {
-    {
-        std::unique_lock locker(mutex_);
-        while (!queue_.empty()) {
-            auto ptr = queue_.front();
-            queue_.pop();
-            mysql_close(ptr);
-        }
+    for (std::size_t i = 0; i < numSlots_; ++i) {
+        slots_[i].conn.Reset();
     }
+    numSlots_ = 0;
     cond_.notify_all();
 }
 
+bool MysqlPool::Connect(MysqlConnection& conn)
+{
+    conn.Reset();
+    conn.mysql = mysql_init(nullptr);
+    if (conn.mysql == nullptr) {
+        MLOG_ERROR("Mysql initialize failed!");
+        return false;
+    }
+    if (mysql_real_connect(conn.mysql, config_.host.c_str(), config_.user.c_str(), config_.passwd.c_str(), config_.dbname.c_str(), config_.port, nullptr, 0) == nullptr) {
+        MLOG_ERROR("Mysql connected failed!");
+        conn.Reset();
+        return false;
+    }
+    conn.lastUsed = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool MysqlPool::CheckHealth(MysqlConnection& conn)
+{
+    // a lost connection takes its prepared statements with it, reconnecting starts over
+    if (conn.mysql == nullptr) {
+        return Connect(conn);
+    }
+    if (std::chrono::steady_clock::now() - conn.lastUsed < std::chrono::milliseconds(config_.pingInterval)) {
+        return true;
+    }
+    if (mysql_ping(conn.mysql) == 0) {
+        return true;
+    }
+    MLOG_INFOR("Mysql connection lost, reconnect!");
+    return Connect(conn);
+}
+
 bool MysqlPool::Initialize(const MysqlConfig& config)
 {
     config_ = config;
     config_.numConnect = std::min(config_.numConnect, MAX_NUM_CONNECT);
 
+    slots_ = std::make_unique<Slot[]>(config_.numConnect);
     for (auto i = 0U; i < config_.numConnect; ++i) {
-        auto ptr = mysql_init(nullptr);
-        if (ptr == nullptr) {
-            MLOG_ERROR("Mysql initialize failed!");
+        if (!Connect(slots_[i].conn)) {
             return false;
         }
-        ptr = mysql_real_connect(ptr, config_.host.c_str(), config_.user.c_str(), config_.passwd.c_str(), config_.dbname.c_str(), config_.port, nullptr, 0);
-        if (ptr == nullptr) {
-            MLOG_ERROR("Mysql connected failed!");
-            return false;
-        }
-        queue_.push(ptr);
+        ++numSlots_;
     }
     MLOG_INFOR("Mysqlpool initialize success!");
     return true;
 }
 
-}
\ No newline at end of file
+}
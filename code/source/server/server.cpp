@@ -11,40 +11,120 @@ Server::Server(ServerConfig config)
     cnTrigMode_ = config.cnTrigNode;
     cnTimeout_ = config.cnTimeout;
     optLinger_ = config.optLinger;
+    listenBacklog_ = config.listenBacklog;
+    acceptBudget_ = std::max(1U, config.acceptBudget);
+    ownedConnections_ = config.ownedConnections;
+    RequestParser::MaxBodySize = config.maxBodySize;
     threadPool_.Initialize(config.numThread);
     MysqlPool::InitInstance(config.mysqlConfig);
+    CredentialCache::Instance()->Initialize(config.mysqlConfig.credentialCacheSize, config.mysqlConfig.credentialTtl, config.mysqlConfig.negativeTtl);
     InitializeEvents();
-    if (!InitializeSocket())
-    {
+
+    auto fileCache = FileCache::Instance();
+    fileCache->Initialize(HttpConnection::ResDir, config.fileCacheSize, config.sendfileThreshold);
+    if (!InstallRoutes(*Router::Instance(), HttpConnection::ResDir.string())) {
         shutdown_ = true;
     }
+
+    auto numReactor = std::clamp(config.numReactor, 1U, MAX_REACTOR_COUNT);
+    for (auto i = 0U; i < numReactor; ++i) {
+        reactors_.emplace_back(std::make_unique<Reactor>());
+        reactors_.back()->server = this;
+        InitializePoller(reactors_.back().get(), config.pollerType);
+        if (!InitializeSocket(reactors_.back().get())) {
+            shutdown_ = true;
+            break;
+        }
+    }
+
+    // every reactor drives its own non-blocking db links, any failure falls back to the blocking pool
+    if (config.asyncDb) {
+        auto success = !reactors_.empty();
+        for (auto& reactor : reactors_) {
+            success = success && reactor->asyncMysql.Initialize(config.mysqlConfig, config.numAsyncConnect, reactor->poller.get(), &Server::OnVerified, reactor.get());
+        }
+        AuthHandler::AsyncVerify = success;
+    }
+
+    auto metrics = Metrics::Instance();
+    metrics->AddGauge("msv_connections_online", "Open client connections.", []() { return HttpConnection::NumOnline.load(); });
+    metrics->AddGauge("msv_reactors", "Event loop threads.", [numReactor]() { return numReactor; });
+    metrics->AddGauge("msv_workers", "Thread pool workers.", [numThread = threadPool_.GetThreadCount()]() { return numThread; });
+
+    // file change notifications are handled by the first reactor
+    if (!reactors_.empty() && fileCache->GetNotifyFd() >= 0) {
+        reactors_[0]->poller->AddFd(fileCache->GetNotifyFd(), EPOLLIN);
+    }
 }
 
 void Server::Start()
 {
-    MLOG_INFOR("Server start!");
+    MLOG_INFOR("Server start! reactor number: ", reactors_.size());
+    for (std::size_t i = 1; i < reactors_.size(); ++i) {
+        reactorThreads_.emplace_back(&Server::Loop, this, reactors_[i].get());
+    }
+    Loop(reactors_[0].get());
+    for (auto& thread : reactorThreads_) {
+        thread.join();
+    }
+    reactorThreads_.clear();
+}
+
+void Server::Loop(Reactor* reactor)
+{
+    auto& poller = *reactor->poller;
+    auto& timingWheel = reactor->timingWheel;
+    auto notifyFd = (reactor == reactors_[0].get()) ? FileCache::Instance()->GetNotifyFd() : -1;
+
     while (!shutdown_) {
-        auto epTimeout = timeNodeHeap_.GetMinTimeout();
+        auto epTimeout = timingWheel.GetMinTimeout();
 
         MLOG_DEBUG("Min epoll timeout: ", epTimeout);
 
-        auto numEvents = epoller_.Wait(static_cast<int>(epTimeout));
+        auto numEvents = poller.Wait(static_cast<int>(epTimeout));
         for (auto i = 0; i < numEvents; ++i) {
-            auto events = epoller_[i].events;
-            auto fd = epoller_[i].data.fd;
-            if (fd == sfd_) {
-                Listen();
+            auto events = poller[i].events;
+            auto handle = poller[i].data.u64;
+            auto fd = ConnectionTable::FdOf(handle);
+            if (events & EVENT_ACCEPTED) {
+                // the peer address is not collected, nothing reads it
+                Accept(reactor, poller.Result(i), {});
+                continue;
+            }
+            if (fd == reactor->sfd) {
+                Listen(reactor);
+                continue;
+            }
+            if (fd == notifyFd) {
+                FileCache::Instance()->HandleNotify();
+                continue;
+            }
+
+            auto conn = connections_.Get(handle);
+            if (conn == nullptr && !(events & EVENT_RECEIVED) && reactor->asyncMysql.HandleEvent(fd, events)) {
+                continue;
+            }
+            if (conn == nullptr) {
+                MLOG_DEBUG("Stale event dropped! fd: ", fd);
+            }
+            else if (events & EVENT_RECEIVED) {
+                timingWheel.Modify(fd, cnTimeout_);
+                HandleReceived(reactor, conn, poller.Result(i), poller.Received(i));
             }
             else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                CloseConnection(&userMapping_[fd]);
+                CloseFromReactor(reactor, handle, false);
+            }
+            else if (ownedConnections_) {
+                timingWheel.Modify(fd, cnTimeout_);
+                HandleOwned(reactor, conn, events);
             }
             else if (events & (EPOLLIN)) {
-                timeNodeHeap_.Modify(fd, cnTimeout_);
-                threadPool_.AddTask(std::bind(&Server::ReadEntry, this, &userMapping_[fd]));
+                timingWheel.Modify(fd, cnTimeout_);
+                threadPool_.AddTask({&Server::OnRead, reactor, handle});
             }
             else if (events & (EPOLLOUT)) {
-                timeNodeHeap_.Modify(fd, cnTimeout_);
-                threadPool_.AddTask(std::bind(&Server::WriteEntry, this, &userMapping_[fd]));
+                timingWheel.Modify(fd, cnTimeout_);
+                threadPool_.AddTask({&Server::OnWrite, reactor, handle});
             }
             else {
                 MLOG_ERROR("Unexpected epoll events: ", events);
@@ -53,87 +133,293 @@ void Server::Start()
     }
 }
 
-void Server::ReadEntry(HttpConnection *conn)
+void Server::OnRead(void* owner, uintptr_t arg)
+{
+    auto reactor = static_cast<Reactor*>(owner);
+    auto& connections = reactor->server->connections_;
+    if (auto conn = connections.Acquire(arg); conn != nullptr) {
+        reactor->server->ReadEntry(reactor, conn);
+        connections.Release(ConnectionTable::FdOf(arg));
+    }
+}
+
+void Server::OnWrite(void* owner, uintptr_t arg)
+{
+    auto reactor = static_cast<Reactor*>(owner);
+    auto& connections = reactor->server->connections_;
+    if (auto conn = connections.Acquire(arg); conn != nullptr) {
+        reactor->server->WriteEntry(reactor, conn);
+        connections.Release(ConnectionTable::FdOf(arg));
+    }
+}
+
+void Server::OnResume(void* owner, uintptr_t arg)
+{
+    auto reactor = static_cast<Reactor*>(owner);
+    auto& connections = reactor->server->connections_;
+    if (auto conn = connections.Acquire(arg); conn != nullptr) {
+        reactor->server->ProcessEntry(reactor, conn);
+        connections.Release(ConnectionTable::FdOf(arg));
+    }
+}
+
+void Server::OnVerified(void* owner, uint64_t handle, bool success)
+{
+    auto reactor = static_cast<Reactor*>(owner);
+    auto server = reactor->server;
+    if (auto conn = server->connections_.Get(handle); conn != nullptr) {
+        conn->FinishVerify(success);
+        if (server->ownedConnections_) {
+            server->HandleOwned(reactor, conn, 0);
+            return;
+        }
+        server->threadPool_.AddTask({&Server::OnResume, reactor, handle});
+    }
+}
+
+void Server::ReadEntry(Reactor* reactor, HttpConnection *conn)
 {
     if (!conn->Read()) {
         MLOG_ERROR("Read error");
-        CloseConnection(conn);
+        CloseConnection(reactor, conn);
         return;
     }
-    ProcessEntry(conn);
+    ProcessEntry(reactor, conn);
 }
 
-void Server::ProcessEntry(HttpConnection *conn)
+void Server::ProcessEntry(Reactor* reactor, HttpConnection *conn)
 {
+    auto fd = conn->GetFd();
     if (conn->Process()) {
-        epoller_.ModFd(conn->GetFd(), connectionEvents_ | EPOLLOUT);
+        reactor->poller->ModFd(fd, connectionEvents_ | EPOLLOUT, connections_.HandleOf(fd));
+    }
+    else if (conn->IsVerifyPending()) {
+        // stays disarmed until OnVerified resumes it
+        const auto& credentials = conn->GetCredentials();
+        reactor->asyncMysql.Submit({connections_.HandleOf(fd), credentials.isLogin, std::string(credentials.username), std::string(credentials.password)});
     }
     else {
-        epoller_.ModFd(conn->GetFd(), connectionEvents_ | EPOLLIN);
+        reactor->poller->ModFd(fd, connectionEvents_ | EPOLLIN, connections_.HandleOf(fd));
     }
 }
 
-void Server::WriteEntry(HttpConnection* conn)
+void Server::WriteEntry(Reactor* reactor, HttpConnection* conn)
 {
     if (!conn->Write()) {
         MLOG_ERROR("Write error");
-        CloseConnection(conn);
+        CloseConnection(reactor, conn);
         return;
     }
     if (!conn->WriteComplete()) {
-        epoller_.ModFd(conn->GetFd(), connectionEvents_ | EPOLLOUT);
+        reactor->poller->ModFd(conn->GetFd(), connectionEvents_ | EPOLLOUT, connections_.HandleOf(conn->GetFd()));
         return;
     }
     if (conn->IsKeepAlive()) {
-        ProcessEntry(conn);
+        ProcessEntry(reactor, conn);
         return;
     }
     MLOG_DEBUG("Write complete and no keep-alive");
-    CloseConnection(conn);
+    CloseConnection(reactor, conn);
 }
 
-void Server::CloseConnection(HttpConnection *conn)
+void Server::HandleOwned(Reactor* reactor, HttpConnection* conn, uint32_t events)
 {
-    if (conn->IsClosed()) {
+    // a read here could overtake bytes the ring has already taken off the socket
+    if (reactor->ringDriven) {
+        Serve(reactor, conn);
+        ResumeReceive(reactor, conn);
         return;
     }
-    MLOG_DEBUG("Connection closed! fd: ", conn->GetFd());
-    epoller_.DelFd(conn->GetFd());
+    auto readable = (events & EPOLLIN) != 0 || conn->HasUnreadInput();
+    while (true) {
+        if (readable && !conn->Read()) {
+            MLOG_ERROR("Read error");
+            CloseConnection(reactor, conn);
+            return;
+        }
+        Serve(reactor, conn);
+        // reads stop at the parser's limit, go on once serving made room
+        if (conn->IsClosed() || !conn->HasUnreadInput()) {
+            return;
+        }
+        readable = true;
+    }
+}
+
+void Server::HandleReceived(Reactor* reactor, HttpConnection* conn, int result, std::string_view data)
+{
+    // end of stream or a failed receive
+    if (result <= 0) {
+        CloseConnection(reactor, conn);
+        return;
+    }
+    if (!conn->Receive(data)) {
+        reactor->poller->StopRecv(conn->GetFd());
+    }
+    Serve(reactor, conn);
+    ResumeReceive(reactor, conn);
+}
+
+void Server::ResumeReceive(Reactor* reactor, HttpConnection* conn)
+{
+    // receiving stopped at the parser's limit, go on once serving made room
+    if (!conn->IsClosed() && conn->ResumeReceive()) {
+        auto fd = conn->GetFd();
+        reactor->poller->RecvMulti(fd, connections_.HandleOf(fd));
+    }
+}
+
+void Server::Serve(Reactor* reactor, HttpConnection* conn)
+{
+    while (true) {
+        if (!conn->WriteComplete()) {
+            if (!conn->Write()) {
+                MLOG_ERROR("Write error");
+                CloseConnection(reactor, conn);
+                return;
+            }
+            if (!conn->WriteComplete()) {
+                SetWriteInterest(reactor, conn, true);
+                return;
+            }
+            if (!conn->IsKeepAlive()) {
+                CloseConnection(reactor, conn);
+                return;
+            }
+        }
+        // a submitted verification resumes through OnVerified, new input just waits in the buffer
+        if (conn->IsVerifyPending()) {
+            break;
+        }
+        auto processed = conn->Process();
+        if (conn->IsVerifyPending()) {
+            // submitted before the batch ahead of it is flushed, a write that blocks must not hold it back
+            const auto& credentials = conn->GetCredentials();
+            reactor->asyncMysql.Submit({connections_.HandleOf(conn->GetFd()), credentials.isLogin, std::string(credentials.username), std::string(credentials.password)});
+        }
+        if (!processed) {
+            break;
+        }
+    }
+    SetWriteInterest(reactor, conn, false);
+}
+
+void Server::SetWriteInterest(Reactor* reactor, HttpConnection* conn, bool enable)
+{
+    // the only epoll_ctl after registration, made when the send buffer fills up and when it drains again
+    if (conn->HasWriteInterest() == enable) {
+        return;
+    }
+    conn->SetWriteInterest(enable);
+    auto fd = conn->GetFd();
+    reactor->poller->ModFd(fd, (reactor->ringDriven ? ringEvents_ : ownedEvents_) | (enable ? EPOLLOUT : 0), connections_.HandleOf(fd));
+}
+
+void Server::CloseConnection(Reactor* reactor, HttpConnection *conn)
+{
+    if (!conn->Claim()) {
+        return;
+    }
+    auto fd = conn->GetFd();
+    MLOG_DEBUG("Connection closed! fd: ", fd);
+    reactor->poller->DelFd(fd);
+    connections_.Retire(fd);
     conn->Close();
 }
 
-void Server::SendError(int cfd, const char *info) const
+void Server::CloseFromReactor(Reactor* reactor, ConnectionTable::Handle handle, bool timedOut)
 {
-    auto len = send(cfd, info, strlen(info), 0);
+    if (connections_.Get(handle) == nullptr) {
+        return;
+    }
+    auto fd = ConnectionTable::FdOf(handle);
+    // a worker is reading, processing or writing, closing now would pull the fd from under it
+    if (!connections_.TryAcquire(fd)) {
+        reactor->timingWheel.Insert(fd, TimingWheel::TICK_MS, [this, reactor, handle, timedOut]() {
+            CloseFromReactor(reactor, handle, timedOut);
+        });
+        return;
+    }
+    if (auto conn = connections_.Get(handle); conn != nullptr) {
+        if (timedOut) {
+            Metrics::Add(Counter::TIMEOUTS);
+        }
+        CloseConnection(reactor, conn);
+    }
+    connections_.Release(fd);
+}
+
+void Server::SendError(int cfd, std::string_view info) const
+{
+    auto len = send(cfd, info.data(), info.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
     if (len < 0) {
         MLOG_ERROR("Send error info failed! fd: ", cfd);
     }
     close(cfd);
 }
 
-void Server::Listen()
+void Server::Listen(Reactor* reactor)
 {
-    struct sockaddr_in addr {0};
-    socklen_t len = sizeof(addr);
-    do {
-        auto cfd = accept(sfd_, reinterpret_cast<sockaddr *>(&addr), &len);
+    for (auto i = 0U; i < acceptBudget_; ++i) {
+        struct sockaddr_in addr {0};
+        socklen_t len = sizeof(addr);
+        auto cfd = accept4(reactor->sfd, reinterpret_cast<sockaddr *>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (cfd < 0) {
             return;
         }
-        if (HttpConnection::NumOnline >= MAX_CONNECTION_NUM) {
-            MLOG_DEBUG("Server busy! online number: ", HttpConnection::NumOnline);
-            SendError(cfd, "Server busy!");
-            return;
+        Accept(reactor, cfd, addr);
+    }
+
+    // budget used up with connections possibly left, an edge triggered listener needs a fresh edge
+    if (listenEvents_ & EPOLLET) {
+        reactor->poller->ModFd(reactor->sfd, listenEvents_ | EPOLLIN);
+    }
+}
+
+void Server::Accept(Reactor* reactor, int cfd, const struct sockaddr_in& addr)
+{
+    Metrics::Add(Counter::ACCEPTS);
+    // shed instead of stopping, so the backlog keeps draining under overload
+    if (HttpConnection::NumOnline >= MAX_CONNECTION_NUM || static_cast<std::size_t>(cfd) >= connections_.Capacity()) {
+        MLOG_DEBUG("Server busy! online number: ", HttpConnection::NumOnline);
+        Metrics::Add(Counter::RESPONSES_5XX);
+        SendError(cfd, BUSY_RESPONSE);
+        return;
+    }
+    auto handle = connections_.Open(cfd);
+    auto conn = connections_[cfd];
+    // an owned connection is edge triggered, so it always reads until EAGAIN
+    conn->Initialize(ownedConnections_ ? TriggerMode::TM_ET : cnTrigMode_, cfd, addr);
+    reactor->timingWheel.Insert(cfd, cnTimeout_, [this, reactor, handle]() {
+        CloseFromReactor(reactor, handle, true);
+    });
+    if (reactor->ringDriven) {
+        reactor->poller->AddFd(cfd, ringEvents_, handle);
+        reactor->poller->RecvMulti(cfd, handle);
+        return;
+    }
+    reactor->poller->AddFd(cfd, ownedConnections_ ? ownedEvents_ : (connectionEvents_ | EPOLLIN), handle);
+}
+
+bool Server::InitializePoller(Reactor* reactor, PollerType type)
+{
+    // the ring is cheap only when every change to it is made on the reactor thread and sent with its next wait
+    if (type == PollerType::IO_URING && !ownedConnections_) {
+        MLOG_ERROR("io_uring needs owned connections, fall back to epoll!");
+    }
+    else if (type == PollerType::IO_URING) {
+        auto uring = std::make_unique<UringPoller>();
+        if (uring->Initialize()) {
+            reactor->poller = std::move(uring);
+            return true;
         }
-        HttpConnection *conn = &(userMapping_[cfd]);
-        conn->Initialize(cnTrigMode_, cfd, addr);
-        timeNodeHeap_.Insert(cfd, cnTimeout_, std::bind(&Server::CloseConnection, this, conn));
-        epoller_.AddFd(cfd, connectionEvents_ | EPOLLIN);
-        fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFD, 0) | O_NONBLOCK);
-    } while (listenEvents_ & EPOLLET);
+        MLOG_ERROR("Initialize io_uring failed, fall back to epoll!");
+    }
+    reactor->poller = std::make_unique<Epoller>();
+    return true;
 }
 
-bool Server::InitializeSocket()
+bool Server::InitializeSocket(Reactor* reactor)
 {
     if (port_ < 1024) {
         MLOG_ERROR("Error server port: ", port_);
@@ -144,8 +430,8 @@ bool Server::InitializeSocket()
     addr.sin_port = htons(port_);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_family = AF_INET;
-    sfd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (sfd_ < 0) {
+    auto sfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sfd < 0) {
         MLOG_ERROR("Create server socket failed!");
         return false;
     }
@@ -155,38 +441,46 @@ bool Server::InitializeSocket()
         lg.l_onoff = 1;
         lg.l_linger = 1;
     }
-    if (auto ret = setsockopt(sfd_, SOL_SOCKET, SO_LINGER, reinterpret_cast<const void *>(&lg), sizeof(lg)); ret < 0) {
+    if (auto ret = setsockopt(sfd, SOL_SOCKET, SO_LINGER, reinterpret_cast<const void *>(&lg), sizeof(lg)); ret < 0) {
         MLOG_ERROR("Set linger option failed!");
-        close(sfd_);
+        close(sfd);
         return false;
     }
 
     int reuse = 1;
-    if (auto ret = setsockopt(sfd_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const void *>(&reuse), sizeof(reuse)); ret < 0) {
+    if (auto ret = setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const void *>(&reuse), sizeof(reuse)); ret < 0) {
         MLOG_ERROR("Set addr reuse failed!");
-        close(sfd_);
+        close(sfd);
+        return false;
+    }
+
+    // every reactor binds its own listening socket, the kernel balances incoming connections among them
+    if (auto ret = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const void *>(&reuse), sizeof(reuse)); ret < 0) {
+        MLOG_ERROR("Set port reuse failed!");
+        close(sfd);
         return false;
     }
 
-    if (auto ret = bind(sfd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)); ret < 0) {
+    if (auto ret = bind(sfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)); ret < 0) {
         MLOG_ERROR("Bind server socket failed!");
-        close(sfd_);
+        close(sfd);
         return false;
     }
 
-    if (auto ret = listen(sfd_, 6); ret < 0) {
+    if (auto ret = listen(sfd, listenBacklog_); ret < 0) {
         MLOG_ERROR("Listen socket failed!");
-        close(sfd_);
+        close(sfd);
         return false;
     }
 
-    if (!epoller_.AddFd(sfd_, listenEvents_ | EPOLLIN)) {
+    reactor->ringDriven = reactor->poller->AcceptMulti(sfd, static_cast<uint32_t>(sfd));
+    if (!reactor->ringDriven && !reactor->poller->AddFd(sfd, listenEvents_ | EPOLLIN)) {
         MLOG_ERROR("Epoll add listen events failed!");
-        close(sfd_);
+        close(sfd);
         return false;
     }
 
-    fcntl(sfd_, F_SETFL, fcntl(sfd_, F_GETFD, 0) | O_NONBLOCK);
+    reactor->sfd = sfd;
     return true;
 }
 
@@ -194,6 +488,9 @@ void Server::InitializeEvents()
 {
     listenEvents_ = EPOLLRDHUP;
     connectionEvents_ = EPOLLONESHOT | EPOLLRDHUP;
+    ownedEvents_ = EPOLLET | EPOLLIN | EPOLLRDHUP;
+    // bytes and the end of the stream come with the ring's receives, the poll only serves EPOLLOUT
+    ringEvents_ = EPOLLET;
 
     if (epTrigMode_ == TriggerMode::TM_ET) {
         listenEvents_ |= EPOLLET;
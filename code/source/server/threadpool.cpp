@@ -1,35 +1,151 @@
 // Author: cute-giggle@outlook.com
 
+#include <algorithm>
+
 #include "threadpool/threadpool.h"
 
 namespace msv {
 
+namespace {
+
+// index of the pool worker running on this thread, -1 elsewhere
+thread_local int64_t currentWorker = -1;
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+}
+
 void ThreadPool::Initialize(uint32_t threadCount)
 {
-    threadCount_ = std::min(threadCount, MAX_THREAD_COUNT);
-    taskQueue_ = std::make_shared<TaskQueue>();
+    threadCount_ = std::clamp(threadCount, 1U, MAX_THREAD_COUNT);
+    injection_ = std::make_unique<BoundedQueue<TaskType>>(INJECTION_CAPACITY);
 
     for (uint32_t i = 0U; i < threadCount_; ++i) {
-        auto threadFunc = [tasks=taskQueue_]() {
-            auto locker = std::unique_lock(tasks->mutex_);
-            while (true) {
-                if (tasks->queue_.empty()) {
-                    tasks->cond_.wait(locker);
-                }
-                if (!tasks->queue_.empty()) {
-                    auto task = std::move(tasks->queue_.front());
-                    tasks->queue_.pop();
-                    locker.unlock();
-                    task();
-                    locker.lock();
+        workers_.emplace_back(std::make_unique<Worker>());
+    }
+    for (uint32_t i = 0U; i < threadCount_; ++i) {
+        workers_[i]->thread = std::thread(&ThreadPool::Run, this, i);
+    }
+}
+
+void ThreadPool::Shutdown()
+{
+    if (shutdown_.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard locker(parkMutex_);
+        parkCond_.notify_all();
+    }
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void ThreadPool::AddTask(TaskType task)
+{
+    // a worker scheduling follow-up work keeps it local, everyone else goes through the injection queue
+    if (currentWorker >= 0 && workers_[currentWorker]->deque.Push(task)) {
+        Wake();
+        return;
+    }
+    while (!injection_->Push(task)) {
+        std::this_thread::yield();
+    }
+    Wake();
+}
+
+void ThreadPool::Run(std::size_t index)
+{
+    currentWorker = static_cast<int64_t>(index);
+
+    TaskType task{};
+    uint32_t spins = 0U;
+    while (!shutdown_.load(std::memory_order_relaxed)) {
+        if (FindTask(index, task)) {
+            spins = 0U;
+            task();
+            continue;
+        }
+        if (spins++ < SPIN_COUNT) {
+            CpuRelax();
+            continue;
+        }
+        spins = 0U;
+        Park();
+    }
+}
+
+bool ThreadPool::FindTask(std::size_t index, TaskType& task)
+{
+    auto& own = workers_[index]->deque;
+    if (own.Pop(task)) {
+        return true;
+    }
+
+    // take one to run and move a batch over, so the rest can be stolen by idle workers
+    if (injection_->Pop(task)) {
+        TaskType extra{};
+        for (std::size_t i = 1; i < BATCH_SIZE && injection_->Pop(extra); ++i) {
+            if (!own.Push(extra)) {
+                while (!injection_->Push(extra)) {
+                    std::this_thread::yield();
                 }
-                if (tasks->shutdown_) {
-                    break;
-                }   
+                break;
             }
-        };
-        std::thread(std::move(threadFunc)).detach();
+        }
+        if (own.Size() > 0) {
+            Wake();
+        }
+        return true;
+    }
+
+    for (std::size_t i = 1; i < workers_.size(); ++i) {
+        auto victim = (index + i) % workers_.size();
+        if (workers_[victim]->deque.Steal(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::HasWork() const
+{
+    if (!injection_->Empty()) {
+        return true;
+    }
+    return std::any_of(workers_.begin(), workers_.end(), [](const auto& worker) { return worker->deque.Size() > 0; });
+}
+
+void ThreadPool::Park()
+{
+    std::unique_lock locker(parkMutex_);
+    numSleeping_.fetch_add(1, std::memory_order_seq_cst);
+    // pairs with the fence in Wake: either the producer sees us sleeping or we see its task
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!HasWork() && !shutdown_.load(std::memory_order_relaxed)) {
+        parkCond_.wait(locker);
+    }
+    numSleeping_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::Wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (numSleeping_.load(std::memory_order_relaxed) == 0) {
+        return;
     }
+    std::lock_guard locker(parkMutex_);
+    parkCond_.notify_one();
 }
 
-}
\ No newline at end of file
+}
@@ -4,120 +4,153 @@
 
 namespace msv::timeout {
 
-void TimeNodeHeap::Insert(int cfd, TimeStamp timeout, TimeoutCallbackFuncType&& callback)
+TimingWheel::TimingWheel()
 {
-    auto iter = userMapping_.find(cfd);
-    if (iter != userMapping_.end()) {
-        data_[iter->second] = {cfd, Now() + timeout, std::move(callback)};
-        if (!AdjustDown(iter->second)) {
-            AdjustUp(iter->second);
-        }
-        MLOG_DEBUG("Time node heap: node reuse.");
-        return;
-    }
-    userMapping_.emplace(cfd, data_.size());
-    data_.push_back({cfd, Now() + timeout, std::move(callback)});
-    AdjustUp(data_.size() - 1);
+    heads_.fill(-1);
+    now_ = Now();
+    currentTick_ = now_ / TICK_MS;
 }
 
-void TimeNodeHeap::Modify(int cfd, TimeStamp timeout)
+void TimingWheel::Insert(int cfd, TimeStamp timeout, TimeoutCallbackFuncType&& callback)
 {
     if (cfd < 0) {
-        MLOG_DEBUG("Modify time node heap failed! invalid fd: ", cfd);
         return;
     }
-    auto iter = userMapping_.find(cfd);
-    if (iter == userMapping_.end()) {
-        MLOG_DEBUG("Modify time node heap failed! fd not exist. fd: ", cfd);
-        return;
+    if (static_cast<std::size_t>(cfd) >= nodes_.size()) {
+        nodes_.resize(cfd + 1);
     }
-    data_[iter->second].expire = Now() + timeout;
-    if (!AdjustDown(iter->second)) {
-        AdjustUp(iter->second);
+    auto& node = nodes_[cfd];
+    if (node.tick >= 0) {
+        MLOG_DEBUG("Timing wheel: node reuse.");
+        Unlink(cfd);
     }
+    node.expire = Now() + timeout;
+    node.callback = std::move(callback);
+    Link(cfd, TickOf(node.expire));
 }
 
-void TimeNodeHeap::Remove(int cfd)
+void TimingWheel::Modify(int cfd, TimeStamp timeout)
 {
-    auto iter = userMapping_.find(cfd);
-    if (iter == userMapping_.end()) {
+    if (cfd < 0 || static_cast<std::size_t>(cfd) >= nodes_.size() || nodes_[cfd].tick < 0) {
+        MLOG_DEBUG("Modify timing wheel failed! fd not exist. fd: ", cfd);
         return;
     }
-    auto index = iter->second;
-    data_[index].callback();
-    Remove(index);
+    auto& node = nodes_[cfd];
+    node.expire = Now() + timeout;
+    // a later deadline is picked up when the current slot comes due, only an earlier one needs relinking
+    auto tick = TickOf(node.expire);
+    if (tick < node.tick) {
+        Unlink(cfd);
+        Link(cfd, tick);
+    }
 }
 
-TimeStamp TimeNodeHeap::GetMinTimeout()
+void TimingWheel::Remove(int cfd)
 {
-    Clean();
-    if (Empty()) {
-        return -1;
+    if (cfd < 0 || static_cast<std::size_t>(cfd) >= nodes_.size() || nodes_[cfd].tick < 0) {
+        return;
     }
-    auto ret = Top().expire - Now();
-    return ret > 0 ? ret : -1;
+    Unlink(cfd);
+    auto callback = std::move(nodes_[cfd].callback);
+    callback();
 }
 
-bool TimeNodeHeap::AdjustDown(std::size_t index)
+TimeStamp TimingWheel::GetMinTimeout()
 {
-    auto backup = index;
-    auto size = data_.size();
-    auto child = index * 2 + 1;
-    while (child < size) {
-        if (child + 1 < size && data_[child + 1] < data_[child]) {
-            child++;
-        }
-        if (!(data_[child] < data_[index])) {
-            break;
-        }
-        std::swap(data_[child], data_[index]);
-        std::swap(userMapping_[data_[child].cfd], userMapping_[data_[index].cfd]);
-        index = child;
-        child = index * 2 + 1;
-    }
-    return backup != index;
+    now_ = Now();
+    Advance();
+    return NextTimeout();
 }
 
-void TimeNodeHeap::AdjustUp(std::size_t index)
+void TimingWheel::Link(int cfd, int64_t tick)
 {
-    auto size = data_.size();
-    auto parent = (index - 1) / 2;
-    while (parent > 0 && parent < size) {
-        if (!(data_[index] < data_[parent])) {
-            break;
-        }
-        std::swap(data_[parent], data_[index]);
-        std::swap(userMapping_[data_[parent].cfd], userMapping_[data_[index].cfd]);
-        index = parent;
-        parent = (parent - 1) / 2;
+    // never schedule into a slot that has already been passed
+    tick = std::max(tick, currentTick_);
+    auto slot = SlotOf(tick);
+    auto& node = nodes_[cfd];
+    node.tick = tick;
+    node.prev = -1;
+    node.next = heads_[slot];
+    if (node.next >= 0) {
+        nodes_[node.next].prev = cfd;
     }
+    heads_[slot] = cfd;
+    occupied_[slot / 64] |= 1ULL << (slot % 64);
+    count_ += 1;
 }
 
-void TimeNodeHeap::Remove(std::size_t index)
+void TimingWheel::Unlink(int cfd)
 {
-    auto last = data_.size() - 1;
-    auto cfd = data_[index].cfd;
-    if (index != last) {
-        std::swap(data_[last], data_[index]);
-        std::swap(userMapping_[data_[last].cfd], userMapping_[data_[index].cfd]);
+    auto& node = nodes_[cfd];
+    auto slot = SlotOf(node.tick);
+    if (node.prev >= 0) {
+        nodes_[node.prev].next = node.next;
+    }
+    else {
+        heads_[slot] = node.next;
     }
-    data_.pop_back();
-    userMapping_.erase(cfd);
-    if (index != last && !AdjustDown(index)) {
-        AdjustUp(index);
+    if (node.next >= 0) {
+        nodes_[node.next].prev = node.prev;
     }
+    if (heads_[slot] < 0) {
+        occupied_[slot / 64] &= ~(1ULL << (slot % 64));
+    }
+    node.prev = node.next = -1;
+    node.tick = -1;
+    count_ -= 1;
 }
 
-void TimeNodeHeap::Clean()
+void TimingWheel::Advance()
 {
-    auto now = Now();
-    while (!Empty()) {
-        const auto& node = Top();
-        if (node.expire > now) {
+    auto nowTick = now_ / TICK_MS;
+    // after a long stall one full turn visits every slot
+    auto first = std::max(currentTick_, nowTick - static_cast<int64_t>(WHEEL_SIZE) + 1);
+    for (auto tick = first; tick <= nowTick; ++tick) {
+        auto slot = SlotOf(tick);
+        if (count_ == 0) {
             break;
         }
-        node.callback();
-        Pop();
+        auto cfd = heads_[slot];
+        while (cfd >= 0) {
+            auto next = nodes_[cfd].next;
+            auto& node = nodes_[cfd];
+            if (node.expire <= now_) {
+                Unlink(cfd);
+                auto callback = std::move(node.callback);
+                callback();
+            }
+            else if (TickOf(node.expire) > tick) {
+                // refreshed since it was slotted, or belongs to a later turn of the wheel
+                Unlink(cfd);
+                Link(cfd, TickOf(node.expire));
+            }
+            cfd = next;
+        }
+    }
+    currentTick_ = nowTick + 1;
+}
+
+TimeStamp TimingWheel::NextTimeout() const
+{
+    if (count_ == 0) {
+        return -1;
     }
+    // find the next occupied slot, scanning the bitmap a word at a time
+    for (std::size_t i = 0; i < WHEEL_SIZE; ) {
+        auto slot = SlotOf(currentTick_ + static_cast<int64_t>(i));
+        auto bits = occupied_[slot / 64] >> (slot % 64);
+        if (bits == 0) {
+            i += 64 - slot % 64;
+            continue;
+        }
+        auto offset = static_cast<std::size_t>(__builtin_ctzll(bits));
+        if (i + offset >= WHEEL_SIZE) {
+            break;
+        }
+        auto timeout = (currentTick_ + static_cast<int64_t>(i + offset)) * TICK_MS - now_;
+        return std::max<TimeStamp>(timeout, 1);
+    }
+    return -1;
+}
+
 }
-}
\ No newline at end of file
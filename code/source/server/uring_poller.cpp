@@ -0,0 +1,489 @@
+// Author: cute-giggle@outlook.com
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+#include "epoller/uring_poller.h"
+#include "utils/mlog.h"
+
+namespace msv {
+
+namespace {
+
+// user_data of poll removals and cancellations, their completions carry nothing
+constexpr uint64_t REMOVE_TAG = ~0ULL;
+constexpr uint32_t POLL_MASK = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+constexpr uint16_t BUFFER_GROUP = 0U;
+
+// user_data: the fd in the low 32 bits, a 24 bit generation above it, the kind of request on top
+constexpr uint64_t POLL_KIND = 0ULL;
+constexpr uint64_t OPERATION_KIND = 1ULL;
+constexpr uint32_t GENERATION_MASK = 0xFFFFFFU;
+
+uint64_t MakeUserData(int fd, uint32_t generation, uint64_t kind = POLL_KIND)
+{
+    return (kind << 56) | (static_cast<uint64_t>(generation & GENERATION_MASK) << 32) | static_cast<uint32_t>(fd);
+}
+
+}
+
+UringPoller::~UringPoller()
+{
+    if (ringFd_ >= 0) {
+        close(ringFd_);
+    }
+    if (bufBase_ != nullptr) {
+        munmap(bufBase_, static_cast<std::size_t>(BUFFER_COUNT) * BUFFER_SIZE);
+    }
+    if (bufRing_ != nullptr) {
+        munmap(bufRing_, bufRingSize_);
+    }
+    if (sqes_ != nullptr) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_ != nullptr) {
+        munmap(sqRing_, sqRingSize_);
+    }
+}
+
+bool UringPoller::Initialize()
+{
+    struct io_uring_params params{};
+    ringFd_ = static_cast<int>(syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params));
+    if (ringFd_ < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    auto singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    auto ring = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    sqRing_ = ring;
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    }
+    else {
+        ring = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if (ring == MAP_FAILED) {
+            return false;
+        }
+        cqRing_ = ring;
+    }
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(ring);
+
+    auto sq = static_cast<char*>(sqRing_);
+    auto cq = static_cast<char*>(cqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    sqLocalTail_ = *sqTail_;
+
+    // multishot receive came with 6.0, as did IORING_OP_SEND_ZC, which the probe does show
+    std::vector<char> storage(sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    auto probe = reinterpret_cast<struct io_uring_probe*>(storage.data());
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0 || probe->last_op < IORING_OP_SEND_ZC) {
+        return false;
+    }
+    if (!InitializeBuffers()) {
+        return false;
+    }
+
+    buffer_.resize(MAX_EVENT_BUFFER_SIZE);
+    completions_.resize(MAX_EVENT_BUFFER_SIZE);
+    return true;
+}
+
+bool UringPoller::InitializeBuffers()
+{
+    bufRingSize_ = BUFFER_COUNT * sizeof(struct io_uring_buf);
+    auto ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    bufRing_ = static_cast<struct io_uring_buf_ring*>(ring);
+    auto base = mmap(nullptr, static_cast<std::size_t>(BUFFER_COUNT) * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    bufBase_ = static_cast<char*>(base);
+
+    struct io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+    for (uint32_t id = 0; id < BUFFER_COUNT; ++id) {
+        ProvideBuffer(static_cast<uint16_t>(id));
+    }
+    PublishBuffers();
+    return true;
+}
+
+void UringPoller::ProvideBuffer(uint16_t id)
+{
+    // the ring's tail overlays the reserved field of its first entry, so the fields are set one by one,
+    // entries are indexed from the ring itself as the flexible array is offset by an empty member in C++
+    auto& buf = reinterpret_cast<struct io_uring_buf*>(bufRing_)[bufTail_ & (BUFFER_COUNT - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(bufBase_ + static_cast<std::size_t>(id) * BUFFER_SIZE);
+    buf.len = BUFFER_SIZE;
+    buf.bid = id;
+    ++bufTail_;
+}
+
+void UringPoller::PublishBuffers()
+{
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+UringPoller::Registration* UringPoller::Find(int fd)
+{
+    if (fd < 0) {
+        return nullptr;
+    }
+    if (static_cast<std::size_t>(fd) >= registrations_.size()) {
+        registrations_.resize(std::max<std::size_t>(fd + 1, registrations_.size() * 2));
+    }
+    return &registrations_[fd];
+}
+
+struct io_uring_sqe* UringPoller::NextSqe()
+{
+    if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+        Submit();
+    }
+    auto index = sqLocalTail_ & sqMask_;
+    auto sqe = &sqes_[index];
+    *sqe = {};
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    ++numPending_;
+    return sqe;
+}
+
+void UringPoller::Submit()
+{
+    if (numPending_ == 0) {
+        return;
+    }
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    while (numPending_ != 0) {
+        auto ret = syscall(__NR_io_uring_enter, ringFd_, numPending_, 0, 0, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            MLOG_ERROR("io_uring submit failed! errno: ", errno);
+            return;
+        }
+        numPending_ -= static_cast<unsigned>(ret);
+    }
+}
+
+void UringPoller::SubmitIfForeign()
+{
+    if (std::this_thread::get_id() != owner_) {
+        Submit();
+    }
+}
+
+void UringPoller::Arm(int fd, Registration& registration)
+{
+    ++registration.generation;
+    registration.armed = true;
+    auto sqe = NextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = registration.events & POLL_MASK;
+    // a multishot poll reports each new wakeup, which is what edge triggering asks for
+    if ((registration.events & EPOLLET) && !(registration.events & EPOLLONESHOT)) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = MakeUserData(fd, registration.generation);
+}
+
+void UringPoller::Disarm(int fd, Registration& registration)
+{
+    registration.armed = false;
+    auto sqe = NextSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(fd, registration.generation);
+    sqe->user_data = REMOVE_TAG;
+}
+
+void UringPoller::Start(int fd, Registration& registration)
+{
+    ++registration.operationGeneration;
+    registration.running = true;
+    auto sqe = NextSqe();
+    sqe->fd = fd;
+    sqe->user_data = MakeUserData(fd, registration.operationGeneration, OPERATION_KIND);
+    if (registration.operation == Operation::ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+}
+
+void UringPoller::Cancel(int fd, Registration& registration)
+{
+    auto sqe = NextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(fd, registration.operationGeneration, OPERATION_KIND);
+    sqe->user_data = REMOVE_TAG;
+}
+
+bool UringPoller::AddFd(int fd, uint32_t events, uint64_t data)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || registration->registered) {
+        return false;
+    }
+    registration->registered = true;
+    registration->events = events;
+    registration->data = data;
+    Arm(fd, *registration);
+    SubmitIfForeign();
+    return true;
+}
+
+bool UringPoller::ModFd(int fd, uint32_t events, uint64_t data)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || !registration->registered) {
+        return false;
+    }
+    if (registration->armed) {
+        Disarm(fd, *registration);
+    }
+    registration->events = events;
+    registration->data = data;
+    Arm(fd, *registration);
+    SubmitIfForeign();
+    return true;
+}
+
+bool UringPoller::DelFd(int fd)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || (!registration->registered && registration->operation == Operation::NONE)) {
+        return false;
+    }
+    if (registration->registered && registration->armed) {
+        Disarm(fd, *registration);
+    }
+    registration->registered = false;
+    ++registration->generation;
+    if (registration->running) {
+        Cancel(fd, *registration);
+    }
+    registration->operation = Operation::NONE;
+    registration->wanted = false;
+    registration->running = false;
+    ++registration->operationGeneration;
+    // the pending requests keep the socket alive after the caller closes the descriptor, until the next Wait
+    SubmitIfForeign();
+    return true;
+}
+
+bool UringPoller::AcceptMulti(int fd, uint64_t data)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || registration->operation != Operation::NONE) {
+        return false;
+    }
+    registration->operation = Operation::ACCEPT;
+    registration->operationData = data;
+    registration->wanted = true;
+    Start(fd, *registration);
+    SubmitIfForeign();
+    return true;
+}
+
+bool UringPoller::RecvMulti(int fd, uint64_t data)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || registration->operation == Operation::ACCEPT) {
+        return false;
+    }
+    registration->operation = Operation::RECV;
+    registration->operationData = data;
+    registration->wanted = true;
+    // a stopped receive that is still running is restarted by its last completion
+    if (!registration->running) {
+        Start(fd, *registration);
+        SubmitIfForeign();
+    }
+    return true;
+}
+
+void UringPoller::StopRecv(int fd)
+{
+    std::lock_guard locker(mutex_);
+    auto registration = Find(fd);
+    if (registration == nullptr || registration->operation != Operation::RECV || !registration->wanted) {
+        return;
+    }
+    registration->wanted = false;
+    if (registration->running) {
+        Cancel(fd, *registration);
+        SubmitIfForeign();
+    }
+}
+
+bool UringPoller::Complete(const struct io_uring_cqe& cqe, int fd, Registration& registration, Completion& completion, uint32_t& events)
+{
+    auto hasBuffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    auto generation = static_cast<uint32_t>(cqe.user_data >> 32) & GENERATION_MASK;
+    // the fd was deleted, and maybe reused, since
+    if (registration.operation == Operation::NONE || (registration.operationGeneration & GENERATION_MASK) != generation) {
+        if (hasBuffer) {
+            ProvideBuffer(id);
+        }
+        return false;
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        registration.running = false;
+    }
+
+    auto reported = false;
+    if (registration.operation == Operation::ACCEPT) {
+        reported = cqe.res >= 0;
+        events = EVENT_ACCEPTED;
+        completion = {cqe.res, nullptr};
+    }
+    else if (cqe.res > 0 && hasBuffer) {
+        reported = true;
+        events = EVENT_RECEIVED;
+        completion = {cqe.res, bufBase_ + static_cast<std::size_t>(id) * BUFFER_SIZE};
+        lentBuffers_.push_back(id);
+        hasBuffer = false;
+    }
+    // out of buffers or stopped, neither is the end of the connection
+    else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        reported = true;
+        events = EVENT_RECEIVED;
+        completion = {cqe.res, nullptr};
+        registration.wanted = false;
+    }
+    if (hasBuffer) {
+        ProvideBuffer(id);
+    }
+    if (!registration.running && registration.wanted) {
+        Start(fd, registration);
+    }
+    return reported;
+}
+
+int UringPoller::Wait(int timeout)
+{
+    {
+        std::lock_guard locker(mutex_);
+        owner_ = std::this_thread::get_id();
+        // the caller is done with what the last Wait reported
+        for (auto id : lentBuffers_) {
+            ProvideBuffer(id);
+        }
+        lentBuffers_.clear();
+        PublishBuffers();
+        Submit();
+    }
+
+    struct __kernel_timespec ts{};
+    struct io_uring_getevents_arg arg{};
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    auto head = __atomic_load_n(cqHead_, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        auto ret = syscall(__NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (ret < 0 && errno != ETIME && errno != EINTR) {
+            return -1;
+        }
+    }
+
+    std::lock_guard locker(mutex_);
+    auto tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    auto numEvents = 0;
+    for (; head != tail && static_cast<std::size_t>(numEvents) < buffer_.size(); ++head) {
+        const auto& cqe = cqes_[head & cqMask_];
+        if (cqe.user_data == REMOVE_TAG) {
+            continue;
+        }
+        auto fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+        auto generation = static_cast<uint32_t>(cqe.user_data >> 32) & GENERATION_MASK;
+        auto registration = Find(fd);
+        if ((cqe.user_data >> 56) == OPERATION_KIND) {
+            uint32_t events = 0;
+            if (Complete(cqe, fd, *registration, completions_[numEvents], events)) {
+                auto& event = buffer_[numEvents++];
+                event.events = events;
+                event.data.u64 = registration->operationData;
+            }
+            continue;
+        }
+        // removed, replaced or deleted since this poll was queued
+        if (!registration->registered || !registration->armed || (registration->generation & GENERATION_MASK) != generation) {
+            continue;
+        }
+        registration->armed = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        if (!registration->armed && !(registration->events & EPOLLONESHOT)) {
+            Arm(fd, *registration);
+        }
+        if (cqe.res == -ECANCELED) {
+            continue;
+        }
+        completions_[numEvents] = {};
+        auto& event = buffer_[numEvents++];
+        event.events = cqe.res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+        event.data.u64 = registration->data;
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return numEvents;
+}
+
+}
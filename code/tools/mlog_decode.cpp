@@ -0,0 +1,157 @@
+// Author: cute-giggle@outlook.com
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include "utils/mlog.h"
+
+// Prints binary mlog records (mlog::Format::BINARY) in the text format.
+namespace {
+
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data_(data) {}
+
+    bool Empty() const
+    {
+        return data_.empty();
+    }
+
+    template<typename T>
+    bool Get(T& value)
+    {
+        if (data_.size() < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data_.data(), sizeof(T));
+        data_.remove_prefix(sizeof(T));
+        return true;
+    }
+
+    bool Get(std::string_view& value, std::size_t length)
+    {
+        if (data_.size() < length) {
+            return false;
+        }
+        value = data_.substr(0, length);
+        data_.remove_prefix(length);
+        return true;
+    }
+
+private:
+    std::string_view data_;
+};
+
+bool DecodeValue(Reader& reader, std::string& out)
+{
+    using mlog::binary::Tag;
+
+    Tag tag{};
+    if (!reader.Get(tag)) {
+        return false;
+    }
+    switch (tag) {
+    case Tag::INT: {
+        int64_t value = 0;
+        if (!reader.Get(value)) {
+            return false;
+        }
+        out += std::to_string(value);
+        return true;
+    }
+    case Tag::UINT: {
+        uint64_t value = 0;
+        if (!reader.Get(value)) {
+            return false;
+        }
+        out += std::to_string(value);
+        return true;
+    }
+    case Tag::REAL: {
+        double value = 0;
+        if (!reader.Get(value)) {
+            return false;
+        }
+        std::ostringstream buffer;
+        buffer << value;
+        out += buffer.str();
+        return true;
+    }
+    case Tag::BOOL: {
+        uint8_t value = 0;
+        if (!reader.Get(value)) {
+            return false;
+        }
+        out += value ? "1" : "0";
+        return true;
+    }
+    case Tag::STRING: {
+        uint32_t length = 0;
+        std::string_view value;
+        if (!reader.Get(length) || !reader.Get(value, length)) {
+            return false;
+        }
+        out += value;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool DecodeRecord(Reader& reader, std::string& out)
+{
+    uint16_t magic = 0;
+    uint8_t level = 0, argc = 0;
+    uint64_t nanoseconds = 0;
+    uint32_t line = 0;
+    uint16_t fileLength = 0;
+    std::string_view file;
+    if (!reader.Get(magic) || magic != mlog::binary::MAGIC) {
+        return false;
+    }
+    if (!reader.Get(level) || level >= static_cast<uint8_t>(mlog::Level::L_CLOSE) || !reader.Get(argc) || !reader.Get(nanoseconds) || !reader.Get(line) || !reader.Get(fileLength) || !reader.Get(file, fileLength)) {
+        return false;
+    }
+
+    out = mlog::levelName(static_cast<mlog::Level>(level));
+    out += ": " + mlog::Collection::timestamp(nanoseconds) + ": ";
+    out.append(file);
+    out += ":" + std::to_string(line) + ": ";
+    for (auto i = 0U; i < argc; ++i) {
+        if (!DecodeValue(reader, out)) {
+            return false;
+        }
+    }
+
+    char separator = 0;
+    return reader.Get(separator) && separator == '\n';
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::ifstream file;
+    if (argc > 1) {
+        file.open(argv[1], std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "Open %s failed!\n", argv[1]);
+            return 1;
+        }
+    }
+    std::istream& input = argc > 1 ? file : std::cin;
+    std::string data(std::istreambuf_iterator<char>(input), {});
+
+    Reader reader(data);
+    std::string record;
+    while (!reader.Empty()) {
+        if (!DecodeRecord(reader, record)) {
+            fprintf(stderr, "Corrupted record!\n");
+            return 1;
+        }
+        puts(record.c_str());
+    }
+    return 0;
+}